@@ -0,0 +1,134 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <deque>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "copy_on_write_ptr.hpp"
+#include "cow_history.hpp"
+#include "cow_ownership_flags/thread_unsafe_flag.hpp"
+#include "shared.hpp"
+
+// === FORWARD DECLARATIONS ===
+
+// Import shared definitions
+using namespace Shared;
+
+// The simulated state is split into blocks, only a few of which are updated at every time step
+using Block = std::vector<double>;
+using BlockHistory = cow_history<Block, cow_ownership_flags::thread_unsafe_flag>;
+
+// === PERFORMANCE TEST BODY ===
+
+int main() {
+
+   // === PART 0 : TEST-WIDE DEFINITIONS ===
+
+   // Open performance counters before any thread is spawned, so that they cover every thread
+   PerfCounters::open_process_counters();
+
+   const std::size_t block_amount = 256;
+   const std::size_t block_size = 16 * 1024;
+   const std::size_t blocks_written_per_step = 4;
+   const std::size_t step_amount = 2000;
+   const std::size_t checkpoint_interval = 10;
+   const std::size_t max_versions = 32;
+   const std::size_t block_bytes = block_size * sizeof(double);
+
+   // Say hi :)
+   std::cout << std::endl << "=== Benchmarking checkpointing strategies ===" << std::endl;
+   std::cout << std::endl << "Simulating " << step_amount << " steps over " << block_amount << " blocks of "
+             << block_bytes / 1024 << " KiB, writing " << blocks_written_per_step << " blocks per step, "
+             << "checkpointing every " << checkpoint_interval << " steps and retaining "
+             << max_versions << " checkpoints" << std::endl;
+
+   // === PART 1 : FULL-COPY CHECKPOINTING ===
+
+   std::size_t full_copy_bytes = 0;
+   {
+      std::mt19937 rng;
+      std::uniform_int_distribution<std::size_t> pick_block(0, block_amount - 1);
+      std::vector<Block> state(block_amount, Block(block_size, typical_value));
+      std::deque<std::vector<Block>> checkpoints;
+      std::size_t step = 0;
+
+      PerfCounters counters;
+      const auto duration = measure_it(
+         [&](){
+            for(std::size_t i = 0; i < blocks_written_per_step; ++i) {
+               Block & block = state[pick_block(rng)];
+               for(double & x : block) x += 1.0;
+            }
+            if(++step % checkpoint_interval == 0) {
+               checkpoints.push_back(state);
+               if(checkpoints.size() > max_versions) checkpoints.pop_front();
+            }
+         },
+         step_amount,
+         counters
+      );
+
+      full_copy_bytes = (checkpoints.size() + 1) * block_amount * block_bytes;
+      std::cout << std::endl << "With full-copy checkpointing, this takes " << duration.count() << " s "
+                << "and retains " << full_copy_bytes / (1024 * 1024) << " MiB" << std::endl;
+      print_counters(counters, step_amount);
+   }
+
+   // === PART 2 : COPY-ON-WRITE CHECKPOINTING ===
+
+   {
+      std::mt19937 rng;
+      std::uniform_int_distribution<std::size_t> pick_block(0, block_amount - 1);
+      std::vector<BlockHistory> state;
+      state.reserve(block_amount);
+      for(std::size_t i = 0; i < block_amount; ++i) {
+         state.emplace_back(new Block(block_size, typical_value), max_versions);
+      }
+      std::size_t step = 0;
+
+      PerfCounters counters;
+      const auto duration = measure_it(
+         [&](){
+            for(std::size_t i = 0; i < blocks_written_per_step; ++i) {
+               BlockHistory & history = state[pick_block(rng)];
+               history.modify([](Block & block){
+                  for(double & x : block) x += 1.0;
+               });
+            }
+            if(++step % checkpoint_interval == 0) {
+               for(BlockHistory & history : state) history.snapshot();
+            }
+         },
+         step_amount,
+         counters
+      );
+
+      std::size_t payload_amount = 0;
+      for(const BlockHistory & history : state) payload_amount += history.distinct_payloads();
+      const std::size_t cow_bytes = payload_amount * block_bytes;
+      std::cout << "With copy-on-write snapshots, it takes " << duration.count() << " s "
+                << "and retains " << cow_bytes / (1024 * 1024) << " MiB ("
+                << static_cast<float>(full_copy_bytes) / cow_bytes << "x less memory)" << std::endl;
+      print_counters(counters, step_amount);
+   }
+
+   // === TEST FINALIZATION ===
+
+   std::cout << std::endl;
+   return 0;
+
+}
@@ -0,0 +1,143 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "cow_ownership_flags/manually_ordered_atomics_flag.hpp"
+#include "journaled_copy_on_write_ptr.hpp"
+#include "shared.hpp"
+
+// === FORWARD DECLARATIONS ===
+
+// Import shared definitions
+using namespace Shared;
+
+// Specialization of time_it for my comparison purposes, which also reports hardware counters
+template<typename Callable1,
+         typename Callable2>
+void compare_it(Callable1 && eager_operation,
+                Callable2 && journaled_operation,
+                const std::size_t amount) {
+   PerfCounters eager_counters;
+   const auto eager_duration = Shared::measure_it(eager_operation, amount, eager_counters);
+   std::cout << "With eager copies, this operation takes "
+             << eager_duration.count() << " s"
+             << std::endl;
+   print_counters(eager_counters, amount);
+
+   PerfCounters journaled_counters;
+   const auto journaled_duration = Shared::measure_it(journaled_operation, amount, journaled_counters);
+   std::cout << "With a write journal, it takes "
+             << journaled_duration.count() << " s ("
+             << eager_duration.count() / journaled_duration.count() << "x faster)"
+             << std::endl;
+   print_counters(journaled_counters, amount);
+}
+
+// Copy a pointer, write to a fraction of its elements, then perform a read-only phase
+template <typename Pointer,
+          typename KeyDistribution>
+void write_then_read(const Pointer & source,
+                     const std::size_t write_amount,
+                     const std::size_t read_amount,
+                     std::mt19937 & rng,
+                     KeyDistribution & pick_key) {
+   Pointer pointer{source};
+   for(std::size_t i = 0; i < write_amount; ++i) pointer.set(pick_key(rng), typical_value + 1);
+   Data sum = 0;
+   for(std::size_t i = 0; i < read_amount; ++i) {
+      const Data * element = pointer.find(pick_key(rng));
+      if(element != nullptr) sum += *element;
+   }
+   if(sum == 0) std::cout << "(Nothing was read)" << std::endl;
+}
+
+// Run the above for eagerly copied and journaled pointers, at several write ratios
+template <typename Payload>
+void benchmark_payload(Payload * eager_value,
+                       Payload * journaled_value,
+                       const std::size_t size,
+                       const std::size_t read_amount,
+                       const std::size_t iteration_amount) {
+   using Pointer = journaled_copy_on_write_ptr<Payload, cow_ownership_flags::manually_ordered_atomics_flag>;
+   const Pointer eager_source{eager_value, 0.0};
+   const Pointer journaled_source{journaled_value};
+
+   for(std::size_t writes_per_million = 100; writes_per_million <= 100000; writes_per_million *= 10) {
+      const std::size_t write_amount = size * writes_per_million / 1000000;
+      std::cout << std::endl << "Writing " << write_amount << " elements ("
+                << writes_per_million / 10000.0 << "% of the payload) of " << iteration_amount
+                << " pointer copies, then reading " << read_amount << " elements" << std::endl;
+
+      std::mt19937 rng;
+      std::uniform_int_distribution<std::size_t> pick_key(0, size - 1);
+      compare_it(
+         [&](){ write_then_read(eager_source, write_amount, read_amount, rng, pick_key); },
+         [&](){ write_then_read(journaled_source, write_amount, read_amount, rng, pick_key); },
+         iteration_amount
+      );
+   }
+}
+
+// === PERFORMANCE TEST BODY ===
+
+int main() {
+
+   // === PART 0 : TEST-WIDE DEFINITIONS ===
+
+   // Open performance counters before any thread is spawned, so that they cover every thread
+   PerfCounters::open_process_counters();
+
+   // Define our payload types
+   using ArrayPayload = std::vector<Data>;
+   using MapPayload = std::map<std::size_t, Data>;
+
+   const std::size_t array_size = 4 * 1024 * 1024;
+   const std::size_t map_size = 64 * 1024;
+   const std::size_t read_amount = 10000;
+
+   // Say hi :)
+   std::cout << std::endl << "=== Benchmarking write journaling ===" << std::endl;
+   std::cout << std::endl << "(The journal is applied once its memory footprint exceeds 1/64 of the payload's)" << std::endl;
+
+   // === PART 1 : ARRAY-LIKE PAYLOAD ===
+
+   std::cout << std::endl << "--- Array of " << array_size << " elements ---" << std::endl;
+   benchmark_payload(new ArrayPayload(array_size, typical_value),
+                     new ArrayPayload(array_size, typical_value),
+                     array_size,
+                     read_amount,
+                     50);
+
+   // === PART 2 : MAP-LIKE PAYLOAD ===
+
+   MapPayload map_value;
+   for(std::size_t i = 0; i < map_size; ++i) map_value.insert(std::make_pair(i, typical_value));
+   std::cout << std::endl << "--- Map of " << map_size << " elements ---" << std::endl;
+   benchmark_payload(new MapPayload(map_value),
+                     new MapPayload(map_value),
+                     map_size,
+                     read_amount,
+                     50);
+
+   // === TEST FINALIZATION ===
+
+   std::cout << std::endl;
+   return 0;
+
+}
@@ -0,0 +1,158 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "copy_on_write_ptr.hpp"
+#include "cow_ownership_flags/manually_ordered_atomics_flag.hpp"
+#include "cow_parallel_copy.hpp"
+#include "shared.hpp"
+
+// === FORWARD DECLARATIONS ===
+
+// Import shared definitions
+using namespace Shared;
+
+// Specialization of time_it for my comparison purposes, which also reports hardware counters
+template<typename Callable1,
+         typename Callable2>
+void compare_it(Callable1 && serial_operation,
+                Callable2 && parallel_operation,
+                const std::size_t amount) {
+   PerfCounters serial_counters;
+   const auto serial_duration = Shared::measure_it(serial_operation, amount, serial_counters);
+   std::cout << "With a std::vector payload, this operation takes "
+             << serial_duration.count() << " s"
+             << std::endl;
+   print_counters(serial_counters, amount);
+
+   PerfCounters parallel_counters;
+   const auto parallel_duration = Shared::measure_it(parallel_operation, amount, parallel_counters);
+   std::cout << "With a large_array payload, it takes "
+             << parallel_duration.count() << " s ("
+             << serial_duration.count() / parallel_duration.count() << "x faster)"
+             << std::endl;
+   print_counters(parallel_counters, amount);
+}
+
+// Variant of the above for sweeps over copy pool configurations, which are compared to a baseline
+template<typename Callable>
+Shared::Duration report_it(Callable && operation,
+                           const std::size_t amount,
+                           const unsigned worker_amount,
+                           const bool streaming,
+                           const Shared::Duration baseline_duration) {
+   PerfCounters counters;
+   const auto duration = Shared::measure_it(operation, amount, counters);
+   std::cout << "With " << worker_amount << " worker(s) and streaming " << (streaming ? "on" : "off")
+             << ", this operation takes " << duration.count() << " s";
+   if(baseline_duration.count() > 0) {
+      std::cout << " (" << baseline_duration.count() / duration.count() << "x faster)";
+   }
+   std::cout << std::endl;
+   print_counters(counters, amount);
+   return duration;
+}
+
+// === PERFORMANCE TEST BODY ===
+
+int main() {
+
+   // === PART 0 : TEST-WIDE DEFINITIONS ===
+
+   // Open performance counters before any thread is spawned, so that they cover every thread
+   PerfCounters::open_process_counters();
+
+   // Define our payload and smart pointer types
+   using SerialPayload = std::vector<Data>;
+   using ParallelPayload = cow_parallel_copy::large_array<Data>;
+   using SerialPointer = copy_on_write_ptr<SerialPayload, cow_ownership_flags::manually_ordered_atomics_flag>;
+   using ParallelPointer = copy_on_write_ptr<ParallelPayload, cow_ownership_flags::manually_ordered_atomics_flag>;
+
+   // Say hi :)
+   std::cout << std::endl << "=== Benchmarking parallel lazy copies ===" << std::endl;
+
+   // === PART 1 : COPY ASSIGNMENT + COLD WRITES ===  (NOTE: The write itself is a copy of the same size)
+
+   for(std::size_t megabytes = 16; megabytes <= 512; megabytes *= 4) {
+      const std::size_t size = megabytes * 1024 * 1024 / sizeof(Data);
+      const std::size_t cold_write_amount = 2048 / megabytes;
+      std::cout << std::endl << "Performing " << cold_write_amount << " pointer copies AND cold writes of "
+                << megabytes << " MiB payloads" << std::endl;
+
+      const SerialPointer source_serial{new SerialPayload(size, typical_value)};
+      const ParallelPointer source_parallel{new ParallelPayload(size, typical_value)};
+      const SerialPayload value_serial(size, typical_value);
+      const ParallelPayload value_parallel(size, typical_value);
+
+      SerialPointer dest_serial{source_serial};
+      ParallelPointer dest_parallel{source_parallel};
+
+      compare_it(
+         [&](){
+            dest_serial = source_serial;
+            dest_serial.write(value_serial);
+         },
+         [&](){
+            dest_parallel = source_parallel;
+            dest_parallel.write(value_parallel);
+         },
+         cold_write_amount
+      );
+   }
+
+   // === PART 2 : COLD WRITE SCALING ===  (NOTE: The baseline is the first line, a serial copy)
+
+   {
+      const std::size_t megabytes = 256;
+      const std::size_t size = megabytes * 1024 * 1024 / sizeof(Data);
+      const std::size_t cold_write_amount = 8;
+      std::cout << std::endl << "Performing " << cold_write_amount << " pointer copies AND cold single-element writes of "
+                << megabytes << " MiB payloads, for varying copy pool configurations" << std::endl;
+
+      const ParallelPointer source{new ParallelPayload(size, typical_value)};
+      ParallelPointer dest{source};
+      const auto cold_write = [&](){
+         dest = source;
+         dest.modify([](ParallelPayload & payload){ payload[0] = typical_value + 1; });
+      };
+
+      // Sweep from a serial copy to one worker per hardware thread but ours, doubling each time
+      cow_parallel_copy::copy_pool & pool = cow_parallel_copy::copy_pool::global();
+      const unsigned default_worker_amount = pool.worker_amount();
+      const unsigned hardware_threads = std::max(std::thread::hardware_concurrency(), 1u);
+      Shared::Duration baseline_duration{0};
+      for(unsigned thread_amount = 1; ; thread_amount = std::min(2 * thread_amount, hardware_threads)) {
+         pool.set_worker_amount(thread_amount - 1);
+         for(const bool streaming : {false, true}) {
+            pool.set_streaming_threshold(streaming ? 0 : std::numeric_limits<std::size_t>::max());
+            const auto duration = report_it(cold_write, cold_write_amount, thread_amount - 1, streaming, baseline_duration);
+            if(baseline_duration.count() == 0) baseline_duration = duration;
+         }
+         if(thread_amount == hardware_threads) break;
+      }
+      pool.set_worker_amount(default_worker_amount);
+   }
+
+   // === TEST FINALIZATION ===
+
+   std::cout << std::endl;
+   return 0;
+
+}
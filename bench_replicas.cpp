@@ -0,0 +1,109 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "cow_ownership_flags/manually_ordered_atomics_flag.hpp"
+#include "replicated_copy_on_write_ptr.hpp"
+#include "shared.hpp"
+
+// === FORWARD DECLARATIONS ===
+
+// Import shared definitions
+using namespace Shared;
+
+// Specialization of time_it for my comparison purposes, which also reports hardware counters
+template<typename Callable>
+Shared::Duration report_it(Callable && operation,
+                           const std::size_t amount,
+                           const std::size_t replicas,
+                           const Shared::Duration baseline_duration) {
+   PerfCounters counters;
+   const auto duration = Shared::measure_it(operation, amount, counters);
+   std::cout << "With " << replicas << " cop" << ((replicas == 1) ? "y" : "ies")
+             << " of the payload, this operation takes " << duration.count() << " s";
+   if(baseline_duration.count() > 0) {
+      std::cout << " (" << baseline_duration.count() / duration.count() << "x faster)";
+   }
+   std::cout << std::endl;
+   print_counters(counters, amount);
+   return duration;
+}
+
+// === PERFORMANCE TEST BODY ===
+
+int main() {
+
+   // === PART 0 : TEST-WIDE DEFINITIONS ===
+
+   // Open performance counters before any thread is spawned, so that they cover every thread
+   PerfCounters::open_process_counters();
+
+   // Define our payload and smart pointer types
+   using Payload = std::vector<Data>;
+   using Pointer = replicated_copy_on_write_ptr<Payload, cow_ownership_flags::manually_ordered_atomics_flag>;
+
+   // Readers are spread across the nodes of a simulated topology, whose size varies
+   const std::size_t megabytes = 16;
+   const std::size_t size = megabytes * 1024 * 1024 / sizeof(Data);
+   const std::size_t reader_amount = 8;
+   const std::size_t max_node_amount = 8;
+
+   // Say hi :)
+   std::cout << std::endl << "=== Benchmarking NUMA read replicas ===" << std::endl;
+   std::cout << std::endl << "The machine has " << cow_numa::topology::system()->node_count()
+             << " NUMA node(s), larger topologies are simulated by splitting its CPUs" << std::endl;
+
+   // === PART 1 : PARALLEL SCANS ===  (NOTE: Replicas are made before measurements start)
+
+   const std::size_t scan_amount = 20;
+   std::cout << std::endl << "Having " << reader_amount << " threads scan a " << megabytes << " MiB payload, "
+             << scan_amount << " times" << std::endl;
+
+   Shared::Duration baseline_duration{0};
+   for(std::size_t node_amount = 1; node_amount <= max_node_amount; node_amount *= 2) {
+      const auto topology = cow_numa::topology::simulated(node_amount);
+      const Pointer pointer{new Payload(size, typical_value), topology};
+      for(std::size_t node = 0; node < node_amount; ++node) pointer.read_on(node);
+
+      // Threads of nodes without CPUs, if any, read from their node's replica explicitly
+      std::vector<std::size_t> sums(reader_amount);
+      const auto scan = [&](){
+         std::vector<std::thread> readers;
+         for(std::size_t reader = 0; reader < reader_amount; ++reader) {
+            readers.emplace_back([&, reader](){
+               const std::size_t node = reader % node_amount;
+               const bool bound = !topology->cpus_of(node).empty();
+               if(bound) topology->bind_current_thread(node);
+               std::size_t sum = 0;
+               for(const Data element : (bound ? pointer.read() : pointer.read_on(node))) sum += element;
+               sums[reader] += sum;
+            });
+         }
+         for(auto & reader : readers) reader.join();
+      };
+
+      const auto duration = report_it(scan, scan_amount, node_amount, baseline_duration);
+      if(node_amount == 1) baseline_duration = duration;
+   }
+
+   // === TEST FINALIZATION ===
+
+   std::cout << std::endl;
+   return 0;
+
+}
@@ -0,0 +1,187 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "copy_on_write_ptr.hpp"
+#include "cow_ownership_flags/manually_ordered_atomics_flag.hpp"
+#include "cow_rope.hpp"
+#include "shared.hpp"
+
+// === FORWARD DECLARATIONS ===
+
+// Import shared definitions
+using namespace Shared;
+
+// Specialization of time_it for my comparison purposes, which also reports hardware counters
+template<typename Callable1,
+         typename Callable2>
+void compare_it(Callable1 && string_operation,
+                Callable2 && rope_operation,
+                const std::size_t amount) {
+   PerfCounters string_counters;
+   const auto string_duration = Shared::measure_it(string_operation, amount, string_counters);
+   std::cout << "With copy_on_write_ptr<std::string>, this operation takes "
+             << string_duration.count() << " s"
+             << std::endl;
+   print_counters(string_counters, amount);
+
+   PerfCounters rope_counters;
+   const auto rope_duration = Shared::measure_it(rope_operation, amount, rope_counters);
+   std::cout << "With cow_rope, it takes "
+             << rope_duration.count() << " s ("
+             << string_duration.count() / rope_duration.count() << "x faster)"
+             << std::endl;
+   print_counters(rope_counters, amount);
+}
+
+// === PERFORMANCE TEST BODY ===
+
+int main() {
+
+   // === PART 0 : TEST-WIDE DEFINITIONS ===
+
+   // Open performance counters before any thread is spawned, so that they cover every thread
+   PerfCounters::open_process_counters();
+
+   // Define our text types
+   using StringPointer = copy_on_write_ptr<std::string, cow_ownership_flags::manually_ordered_atomics_flag>;
+   using Rope = cow_rope<cow_ownership_flags::manually_ordered_atomics_flag>;
+
+   // Generate a document
+   const std::size_t document_size = 16 * 1024 * 1024;
+   std::string document(document_size, ' ');
+   std::mt19937 rng;
+   std::uniform_int_distribution<int> pick_letter('a', 'z');
+   for(char & character : document) character = static_cast<char>(pick_letter(rng));
+   std::uniform_int_distribution<std::size_t> pick_position(0, document_size / 2);
+
+   StringPointer string_document{new std::string(document)};
+   Rope rope_document{document};
+
+   // Say hi :)
+   std::cout << std::endl << "=== Benchmarking copy-on-write text buffers ===" << std::endl;
+   std::cout << std::endl << "Working on a document of " << document_size / (1024 * 1024) << " MiB" << std::endl;
+
+   // === PART 1 : SNAPSHOT + CHARACTER EDIT ===
+
+   const std::size_t edit_amount = 200;
+   std::cout << std::endl << "Taking " << edit_amount << " snapshots, each followed by a character edit" << std::endl;
+   {
+      StringPointer string_snapshot{string_document};
+      Rope rope_snapshot{rope_document};
+
+      compare_it(
+         [&](){
+            string_snapshot = string_document;
+            const std::size_t pos = pick_position(rng);
+            string_document.modify([&](std::string & text){ text[pos] = 'X'; });
+         },
+         [&](){
+            rope_snapshot = rope_document;
+            rope_document.set(pick_position(rng), 'X');
+         },
+         edit_amount
+      );
+   }
+
+   // === PART 2 : SNAPSHOT + INSERTION ===
+
+   std::cout << std::endl << "Taking " << edit_amount << " snapshots, each followed by a 16-character insertion" << std::endl;
+   {
+      const std::string insertion(16, 'I');
+      StringPointer string_snapshot{string_document};
+      Rope rope_snapshot{rope_document};
+
+      compare_it(
+         [&](){
+            string_snapshot = string_document;
+            const std::size_t pos = pick_position(rng);
+            string_document.modify([&](std::string & text){ text.insert(pos, insertion); });
+         },
+         [&](){
+            rope_snapshot = rope_document;
+            rope_document.insert(pick_position(rng), insertion);
+         },
+         edit_amount
+      );
+   }
+
+   // === PART 3 : SNAPSHOT + ERASURE ===
+
+   std::cout << std::endl << "Taking " << edit_amount << " snapshots, each followed by a 4096-character erasure" << std::endl;
+   {
+      StringPointer string_snapshot{string_document};
+      Rope rope_snapshot{rope_document};
+
+      compare_it(
+         [&](){
+            string_snapshot = string_document;
+            const std::size_t pos = pick_position(rng);
+            string_document.modify([&](std::string & text){ text.erase(pos, 4096); });
+         },
+         [&](){
+            rope_snapshot = rope_document;
+            rope_document.erase(pick_position(rng), 4096);
+         },
+         edit_amount
+      );
+   }
+
+   // === PART 4 : UNSHARED CHARACTER EDITS ===  (NOTE: The string is edited in place, the rope mostly so)
+
+   const std::size_t unshared_edit_amount = 1000 * 1000;
+   std::cout << std::endl << "Performing " << unshared_edit_amount << " character edits without snapshots" << std::endl;
+   {
+      compare_it(
+         [&](){
+            const std::size_t pos = pick_position(rng);
+            string_document.modify([&](std::string & text){ text[pos] = 'Y'; });
+         },
+         [&](){
+            rope_document.set(pick_position(rng), 'Y');
+         },
+         unshared_edit_amount
+      );
+   }
+
+   // === PART 5 : SEQUENTIAL SCAN ===
+
+   const std::size_t scan_amount = 20;
+   std::cout << std::endl << "Scanning the document " << scan_amount << " times" << std::endl;
+   {
+      std::size_t string_matches = 0, rope_matches = 0;
+      compare_it(
+         [&](){
+            for(const char character : string_document.read()) string_matches += (character == 'X');
+         },
+         [&](){
+            rope_document.for_each_chunk([&](const std::string & chunk){
+               for(const char character : chunk) rope_matches += (character == 'X');
+            });
+         },
+         scan_amount
+      );
+      if(string_matches + rope_matches == 0) std::cout << "(No edit was found)" << std::endl;
+   }
+
+   // === TEST FINALIZATION ===
+
+   std::cout << std::endl;
+   return 0;
+
+}
@@ -14,33 +14,46 @@
     along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include <iostream>
+#include <thread>
 
 #include "copy_on_write_ptr.hpp"
-#include "cow_ownership_flags/thread_unsafe_flag.hpp"
+#include "cow_ownership_flags/biased_atomics_flag.hpp"
 #include "cow_ownership_flags/manually_ordered_atomics_flag.hpp"
+#include "cow_ownership_flags/mutex_flag.hpp"
+#include "cow_ownership_flags/seq_cst_atomics_flag.hpp"
+#include "cow_ownership_flags/thread_unsafe_flag.hpp"
 #include "shared.hpp"
 
+// The tested ownership flag may be selected at compile time, e.g. -DTESTED_FLAG=biased_atomics_flag
+#ifndef TESTED_FLAG
+#define TESTED_FLAG manually_ordered_atomics_flag
+#endif
+
 // === FORWARD DECLARATIONS ===
 
 // Import shared definitions
 using namespace Shared;
 
-// Specialization of time_it for my comparison purposes
+// Specialization of time_it for my comparison purposes, which also reports hardware counters
 template<typename Callable1,
          typename Callable2>
 void compare_it(Callable1 && unsafe_operation,
                 Callable2 && tested_operation,
                 const std::size_t amount) {
-   const auto unsafe_duration = Shared::time_it(unsafe_operation, amount);
+   PerfCounters unsafe_counters;
+   const auto unsafe_duration = Shared::measure_it(unsafe_operation, amount, unsafe_counters);
    std::cout << "With a thread-unsafe implementation, this operation takes "
              << unsafe_duration.count() << " s"
              << std::endl;
+   print_counters(unsafe_counters, amount);
    
-   const auto tested_duration = Shared::time_it(tested_operation, amount);
+   PerfCounters tested_counters;
+   const auto tested_duration = Shared::measure_it(tested_operation, amount, tested_counters);
    std::cout << "With the tested implementation, it takes "
              << tested_duration.count() << " s ("
              << tested_duration.count() / unsafe_duration.count() << "x slower)"
              << std::endl;
+   print_counters(tested_counters, amount);
 }
 
 // === PERFORMANCE TEST BODY ===
@@ -49,9 +62,12 @@ int main() {
 
    // === PART 0 : TEST-WIDE DEFINITIONS ===
 
+   // Open performance counters before any thread is spawned, so that they cover every thread
+   PerfCounters::open_process_counters();
+
    // Define our smart pointer types
    using UnsafePointer = copy_on_write_ptr<Data, cow_ownership_flags::thread_unsafe_flag>;
-   using TestedPointer = copy_on_write_ptr<Data, cow_ownership_flags::manually_ordered_atomics_flag>;
+   using TestedPointer = copy_on_write_ptr<Data, cow_ownership_flags::TESTED_FLAG>;
    
    // Say hi :)
    std::cout << std::endl << "=== Microbenchmarking cow_ptr ===" << std::endl;
@@ -217,6 +233,41 @@ int main() {
       );
    }
 
+   // === PART 9 : WARM WRITES AFTER SHARING ===  (NOTE: Another thread copies the pointers first)
+
+   const size_t shared_write_amount = warm_write_amount;
+   std::cout << std::endl << "Performing " << shared_write_amount << " warm pointer writes, after another thread copied the pointers" << std::endl;
+   {
+      UnsafePointer unsafe{new Data{typical_value}};
+      TestedPointer tested{new Data{typical_value}};
+
+      // Pointers which were touched by several threads are where flags which favor one thread
+      // must fall back to full synchronization. The copies must keep their value.
+      UnsafePointer * unsafe_copy = nullptr;
+      TestedPointer * tested_copy = nullptr;
+      std::thread other_thread{[&](){
+         unsafe_copy = new UnsafePointer{unsafe};
+         tested_copy = new TestedPointer{tested};
+      }};
+      other_thread.join();
+
+      compare_it(
+         [&](){
+            unsafe.write(typical_value + 1);
+         },
+         [&](){
+            tested.write(typical_value + 1);
+         },
+         shared_write_amount
+      );
+
+      if((unsafe_copy->read() != typical_value) || (tested_copy->read() != typical_value)) {
+         std::cout << "ERROR: Writes leaked into a copy" << std::endl;
+      }
+      delete unsafe_copy;
+      delete tested_copy;
+   }
+
    // === TEST FINALIZATION ===
 
    std::cout << std::endl;
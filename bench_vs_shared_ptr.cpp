@@ -25,22 +25,26 @@
 // Import shared definitions
 using namespace Shared;
 
-// Specialization of time_it for my comparison purposes
+// Specialization of time_it for my comparison purposes, which also reports hardware counters
 template<typename Callable1,
          typename Callable2>
 void compare_it(Callable1 && shptr_operation,
                 Callable2 && cowptr_operation,
                 const std::size_t amount) {
-   const auto shptr_duration = Shared::time_it(shptr_operation, amount);
+   PerfCounters shptr_counters;
+   const auto shptr_duration = Shared::measure_it(shptr_operation, amount, shptr_counters);
    std::cout << "With a raw shared_ptr, this operation takes "
              << shptr_duration.count() << " s"
              << std::endl;
+   print_counters(shptr_counters, amount);
    
-   const auto cowptr_duration = Shared::time_it(cowptr_operation, amount);
+   PerfCounters cowptr_counters;
+   const auto cowptr_duration = Shared::measure_it(cowptr_operation, amount, cowptr_counters);
    std::cout << "With cow_ptr, it takes "
              << cowptr_duration.count() << " s ("
              << cowptr_duration.count() / shptr_duration.count() << "x slower)"
              << std::endl;
+   print_counters(cowptr_counters, amount);
 }
 
 // === PERFORMANCE TEST BODY ===
@@ -49,6 +53,9 @@ int main() {
 
    // === PART 0 : TEST-WIDE DEFINITIONS ===
 
+   // Open performance counters before any thread is spawned, so that they cover every thread
+   PerfCounters::open_process_counters();
+
    // Define our smart pointer types
    using SharedPointer = std::shared_ptr<Data>;
    using COWPointer = copy_on_write_ptr<Data, cow_ownership_flags::thread_unsafe_flag>;
@@ -17,33 +17,105 @@
 #define COW_PTR_H
 
 #include <memory>
+#include <type_traits>
+#include <utility>
 
-// The cow_ptr class implements copy-on-write semantics on top of std::shared_ptr
+#include "cow_ownership_flags/ownership_flag_traits.hpp"
+
+// Threads which wait for another thread to copy a payload of type T may lend it a hand. By default,
+// they wait in whichever way the ownership flag sees fit, but payload types with a cooperative copy
+// routine may specialize this trait so that waiting threads help (see cow_parallel_copy.hpp).
+// Specializations must set enabled, as the waiting routine is only used when it is true.
+template <typename T>
+struct cow_copy_assistance {
+   static const bool enabled = false;
+   static void help() { }
+};
+
+// Steps of copy_on_write_ptr::modify_path(), which lead from a payload to a nested pointer. They
+// may be pointers to data members, or callables which return a reference to the pointer.
+template <typename Payload, typename Class, typename Member>
+Member & cow_path_step(Payload & payload, Member Class::* member) {
+   return payload.*member;
+}
+
+template <typename Payload, typename Step>
+auto cow_path_step(Payload & payload, Step & step) -> decltype(step(payload)) {
+   static_assert(std::is_lvalue_reference<decltype(step(payload))>::value,
+                 "Steps of modify_path() must return a reference to the next pointer, not a copy");
+   return step(payload);
+}
+
+// Copy-on-write pointers keep their ownership flag in this base class. Flags which hold no state,
+// such as immutable_flag, are stored as an empty base of it so that they take up no room. As the
+// library targets C++11, this is done the old way rather than with [[no_unique_address]].
+template <typename OwnershipFlag,
+          bool Stateless = std::is_empty<OwnershipFlag>::value>
+class cow_ownership_storage {
+   protected:
+      explicit cow_ownership_storage(bool owned) : m_ownership{owned} { }
+      explicit cow_ownership_storage(OwnershipFlag && ownership) : m_ownership{std::move(ownership)} { }
+
+      // Copying a const pointer revokes its ownership, hence the constness of this accessor
+      OwnershipFlag & ownership() const { return m_ownership; }
+
+   private:
+      mutable OwnershipFlag m_ownership;
+};
+
+template <typename OwnershipFlag>
+class cow_ownership_storage<OwnershipFlag, true> : private OwnershipFlag {
+   protected:
+      explicit cow_ownership_storage(bool owned) : OwnershipFlag(owned) { }
+      explicit cow_ownership_storage(OwnershipFlag && ownership) : OwnershipFlag(std::move(ownership)) { }
+
+      // A stateless flag has nothing which could be modified through a const pointer
+      OwnershipFlag & ownership() const {
+         return const_cast<cow_ownership_storage &>(*this);
+      }
+};
+
+// The cow_ptr class implements copy-on-write semantics on top of std::shared_ptr.
+// The Deleter, which must be default-constructible, decides how payloads are destroyed once the
+// last pointer to them goes away (see cow_deleters/ for alternatives to plain deletion).
 template <typename T,
-          typename OwnershipFlag>
-class copy_on_write_ptr {
+          typename OwnershipFlag,
+          typename Deleter = std::default_delete<T>>
+class copy_on_write_ptr : private cow_ownership_storage<OwnershipFlag> {
+   static_assert(cow_ownership_flags::check_ownership_flag<OwnershipFlag, false>::value,
+                 "Invalid ownership flag");
+
    public:
       // === BASIC CLASS LIFECYCLE ===
    
       // Construct a cow_ptr from a raw pointer, acquire ownership.
       copy_on_write_ptr(T * ptr) :
-         m_payload{ptr},
-         m_ownership{true}
+         OwnershipStorage{true},
+         m_payload{ptr, Deleter{}}
       { }
       
-      // TODO: As a performance optimization, allow direct construction from a shared_ptr
+      // Construct a cow_ptr from a shared_ptr, DO NOT acquire ownership. Other parties may hold a
+      // reference to the payload, so the first write will trigger a lazy copy.
+      explicit copy_on_write_ptr(std::shared_ptr<T> payload) :
+         OwnershipStorage{false},
+         m_payload{std::move(payload)}
+      { }
       
-      // Move-construct from a copy_on_write_ptr, acquire ownership.
+      // Move-construct from a copy_on_write_ptr, take over its ownership status.
       copy_on_write_ptr(copy_on_write_ptr && cptr) :
-         m_payload{cptr.m_payload},
-         m_ownership{true}
+         OwnershipStorage{std::move(cptr.ownership())},
+         m_payload{std::move(cptr.m_payload)}
       { }
       
       // Copy-construct from a copy_on_write_ptr, DO NOT acquire ownership.
+      // The source pointer must also give up ownership, as the payload is now shared and writing
+      // to it in place would leak into the copy.
       copy_on_write_ptr(const copy_on_write_ptr & cptr) :
-         m_payload{cptr.m_payload},
-         m_ownership{false}
-      { }
+         OwnershipStorage{false},
+         m_payload{cptr.m_payload}
+      {
+         cptr.ownership().set_ownership(false);
+      }
       
       // All our data members can take care of themselves on their own.
       ~copy_on_write_ptr() = default;
@@ -52,10 +124,13 @@ class copy_on_write_ptr {
       copy_on_write_ptr & operator=(copy_on_write_ptr && cptr) = default;
       
       // Copying a copy_on_write_ptr DOES NOT transfer ownership of the underlying content, so we
-      // need to reset our ownership bit in this scenario.
+      // need to reset our ownership bit in this scenario. As with copy construction, the source
+      // pointer loses ownership of the now shared payload too.
       copy_on_write_ptr & operator=(const copy_on_write_ptr & cptr) {
-         m_ownership.set_ownership(false);
+         cptr.ownership().set_ownership(false);
+         ownership().set_ownership(false);
          m_payload = cptr.m_payload;
+         return *this;
       }
       
       
@@ -66,6 +141,7 @@ class copy_on_write_ptr {
       const T & read() const { return *m_payload; }
       
       // Writing to copy-on-write data requires ownership, which must be acquired as needed.
+      // Pointers whose ownership flag cannot be acquired (see immutable_flag.hpp) are read-only.
       void write(const T & value) {
          copy_if_not_owner();
          *m_payload = value;
@@ -73,19 +149,150 @@ class copy_on_write_ptr {
       
       void write(T && value) {
          copy_if_not_owner();
+         *m_payload = std::move(value);
+      }
+      
+      // Modify copy-on-write data in place, by handing a mutable reference to it over to a callable
+      // once ownership has been acquired. This allows small updates to large payloads, and path
+      // copying through payloads which hold copy-on-write pointers themselves (see cow_rope.hpp).
+      // CAUTION: The reference must not be kept around after the callable returns.
+      template <typename Callable>
+      void modify(Callable && modifier) {
+         copy_if_not_owner();
+         modifier(*m_payload);
+      }
+
+      // Modify a payload which is nested within copy-on-write payloads. Every argument but the last
+      // is a step from a payload to the copy_on_write_ptr of the next level (see cow_path_step), and
+      // the last one modifies the innermost payload. Only the pointers along the path acquire
+      // ownership, so an edit deep down a tree copies one payload per level while the rest of the
+      // tree stays shared.
+      template <typename Callable>
+      void modify_path(Callable && modifier) {
+         modify(std::forward<Callable>(modifier));
+      }
+
+      template <typename Step, typename... Steps>
+      void modify_path(Step && step, Steps &&... steps) {
+         modify([&](T & payload){
+            cow_path_step(payload, step).modify_path(std::forward<Steps>(steps)...);
+         });
+      }
+
+      // Try to write to copy-on-write data without waiting for another thread to finish a lazy
+      // copy. If such a copy is in progress, nothing is written and false is returned.
+      bool try_write(const T & value) {
+         if(!try_copy_if_not_owner()) return false;
          *m_payload = value;
+         return true;
+      }
+      
+      bool try_write(T && value) {
+         if(!try_copy_if_not_owner()) return false;
+         *m_payload = std::move(value);
+         return true;
       }
+      
+#if __cplusplus >= 201402L
+      // With an ownership flag which supports it (see awaitable_atomics_flag.hpp), coroutines may
+      // acquire ownership with co_await. If another thread is busy making a lazy copy, the awaiting
+      // coroutine is suspended, and handed over to the scheduler once the copy is done. The
+      // scheduler takes the coroutine's handle and should resume it later, e.g. on an executor.
+      template <typename Scheduler>
+      auto acquire_ownership(Scheduler scheduler) {
+         return ownership().async_acquire_ownership_once([this](){ make_private_copy(); }, std::move(scheduler));
+      }
+      
+      // Awaitable counterpart of write(), built on top of acquire_ownership()
+      template <typename Scheduler>
+      auto async_write(T value, Scheduler scheduler) {
+         auto ownership_awaiter = acquire_ownership(std::move(scheduler));
+         return write_awaiter<decltype(ownership_awaiter)>{std::move(ownership_awaiter), *this, std::move(value)};
+      }
+#endif
+
+      
+      // === CONTENT DEDUPLICATION ===
+      
+      // Merge our payload with an identical one from an interning table (see cow_intern_table.hpp),
+      // or register it there if it's the first of its kind. As the table may hand out our payload
+      // to other pointers from now on, we must give up ownership of it in any case.
+      template <typename InternTable>
+      void intern(InternTable & table) {
+         ownership().set_ownership(false);
+         m_payload = table.intern(m_payload);
+      }
+
+
+      // === DEBUGGING ===
+
+      // Amount of pointers sharing our payload, or zero if we have none (see cow_hierarchy.hpp).
+      // As with std::shared_ptr, this is only a snapshot if other threads copy the pointer.
+      long use_count() const { return m_payload.use_count(); }
 
    private:
+      using OwnershipStorage = cow_ownership_storage<OwnershipFlag>;
+      using OwnershipStorage::ownership;
+
+      static const bool IsWritable = cow_ownership_flags::ownership_flag_traits<OwnershipFlag>::supports_writes;
+
       std::shared_ptr<T> m_payload;
-      OwnershipFlag m_ownership;
       
       // If we are not the owner of the payload object, make a private copy of it
       void copy_if_not_owner() {
-         m_ownership.acquire_ownership_once([this](){
-            m_payload = std::make_shared<T>(*m_payload);
-         });
+         static_assert(IsWritable, "This copy_on_write_ptr is read-only, as its ownership flag cannot be acquired");
+         copy_if_not_owner(std::integral_constant<bool, cow_copy_assistance<T>::enabled>{});
       }
+
+      // Threads which cannot help with a lazy copy leave the flag free to block, e.g. on a mutex
+      void copy_if_not_owner(std::false_type /* assistance */) {
+         ownership().acquire_ownership_once([this](){ make_private_copy(); });
+      }
+
+      void copy_if_not_owner(std::true_type /* assistance */) {
+         ownership().acquire_ownership_once([this](){ make_private_copy(); },
+                                            [](){ cow_copy_assistance<T>::help(); });
+      }
+      
+      // Same as above, but give up and return false if another thread is already making the copy
+      bool try_copy_if_not_owner() {
+         static_assert(IsWritable, "This copy_on_write_ptr is read-only, as its ownership flag cannot be acquired");
+         return ownership().try_acquire_ownership_once([this](){ make_private_copy(); });
+      }
+      
+      void make_private_copy() {
+         m_payload = make_payload(*m_payload, std::is_same<Deleter, std::default_delete<T>>{});
+      }
+      
+      // Allocate a copy of a payload. With the default deleter, we may use make_shared to allocate
+      // the payload and its reference count in one go. Other deleters need a separate allocation.
+      static std::shared_ptr<T> make_payload(const T & value, std::true_type /* default_deleter */) {
+         return std::make_shared<T>(value);
+      }
+      
+      static std::shared_ptr<T> make_payload(const T & value, std::false_type /* default_deleter */) {
+         return std::shared_ptr<T>(new T(value), Deleter{});
+      }
+      
+#if __cplusplus >= 201402L
+      // Awaiter of async_write(), which writes the value once ownership has been acquired
+      template <typename OwnershipAwaiter>
+      struct write_awaiter {
+         OwnershipAwaiter ownership_awaiter;
+         copy_on_write_ptr & pointer;
+         T value;
+         
+         bool await_ready() { return ownership_awaiter.await_ready(); }
+         
+         template <typename CoroutineHandle>
+         bool await_suspend(CoroutineHandle handle) { return ownership_awaiter.await_suspend(handle); }
+         
+         void await_resume() {
+            ownership_awaiter.await_resume();
+            *pointer.m_payload = std::move(value);
+         }
+      };
+#endif
 };
 
 #endif
@@ -0,0 +1,218 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef BACKGROUND_DELETER_H
+#define BACKGROUND_DELETER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace cow_deleters {
+
+   // The background reclaimer destroys retired objects on a dedicated thread, so that the thread
+   // which drops the last reference to a large payload does not have to pay for its teardown.
+   // Retired objects travel through a bounded lock-free queue. When that queue is full, retiring
+   // threads wait for the reclaimer to catch up, which keeps memory usage under control.
+   class background_reclaimer {
+      public:
+
+         // Start a reclaimer whose queue can hold the requested amount of retired objects
+         // (rounded up to a power of two).
+         explicit background_reclaimer(const std::size_t capacity = 1024) :
+            m_cells{new Cell[round_up_to_power_of_two(capacity)]},
+            m_mask{round_up_to_power_of_two(capacity) - 1},
+            m_enqueue_pos{0},
+            m_dequeue_pos{0},
+            m_reclaimed_amount{0},
+            m_sleeping{false},
+            m_stopping{false}
+         {
+            for(std::size_t i = 0; i <= m_mask; ++i) m_cells[i].sequence.store(i, std::memory_order_relaxed);
+            m_thread = std::thread{[this](){ reclamation_loop(); }};
+         }
+
+
+         // Destroying a reclaimer destroys all the objects which were retired to it beforehand.
+         ~background_reclaimer() {
+            m_stopping.store(true);
+            wake_up();
+            m_thread.join();
+         }
+
+
+         // Reclaimers own a thread and are referred to by the objects in flight, so they may
+         // neither be copied nor moved.
+         background_reclaimer(const background_reclaimer &) = delete;
+         background_reclaimer & operator=(const background_reclaimer &) = delete;
+
+
+         // Hand over an object to the reclamation thread, which will delete it later on.
+         template<typename T>
+         void retire(T * object) {
+            if(object == nullptr) return;
+            const Retired retired{object, [](void * obj){ delete static_cast<T *>(obj); }};
+
+            // The reclamation thread itself may release payloads while destroying another one.
+            // Queuing them up would deadlock if the queue is full, so it deletes them right away.
+            if(std::this_thread::get_id() == m_thread.get_id()) {
+               delete object;
+               return;
+            }
+
+            // Apply backpressure by waiting for the reclamation thread to make room in the queue
+            while(!try_push(retired)) {
+               wake_up();
+               std::this_thread::yield();
+            }
+            if(m_sleeping.load()) wake_up();
+         }
+
+
+         // Wait until every object which was retired before this call has been destroyed
+         void flush() {
+            if(std::this_thread::get_id() == m_thread.get_id()) return;
+            const std::size_t target = m_enqueue_pos.load();
+            wake_up();
+            while(m_reclaimed_amount.load(std::memory_order_acquire) < target) {
+               std::this_thread::yield();
+            }
+         }
+
+
+         // Process-wide reclaimer used by background_deleter. It is deliberately never destroyed,
+         // so that payloads which outlive main() can still be retired safely.
+         static background_reclaimer & global() {
+            static background_reclaimer * const instance = new background_reclaimer{};
+            return *instance;
+         }
+
+
+      private:
+
+         // Retired objects are type-erased into a pointer and a matching destruction routine
+         struct Retired {
+            void * object;
+            void (*destroy)(void *);
+         };
+
+         // Our queue is a bounded MPMC ring buffer in the style of Dmitry Vyukov, where each cell
+         // carries a sequence number telling whether it is ready for pushing or popping.
+         struct Cell {
+            std::atomic<std::size_t> sequence;
+            Retired retired;
+         };
+
+         std::unique_ptr<Cell[]> m_cells;
+         const std::size_t m_mask;
+         std::atomic<std::size_t> m_enqueue_pos;
+         std::atomic<std::size_t> m_dequeue_pos;
+         std::atomic<std::size_t> m_reclaimed_amount;
+
+         std::atomic<bool> m_sleeping;
+         std::atomic<bool> m_stopping;
+         std::mutex m_wake_mutex;
+         std::condition_variable m_wake_condition;
+         std::thread m_thread;
+
+         static std::size_t round_up_to_power_of_two(const std::size_t amount) {
+            std::size_t result = 1;
+            while(result < amount) result *= 2;
+            return result;
+         }
+
+         bool try_push(const Retired & retired) {
+            std::size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            Cell * cell;
+            while(true) {
+               cell = &m_cells[pos & m_mask];
+               const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+               const std::intptr_t difference = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+               if(difference == 0) {
+                  // The cell is free, try to claim it. This is sequentially consistent so that the
+                  // reclamation thread cannot miss it when deciding to go to sleep.
+                  if(m_enqueue_pos.compare_exchange_weak(pos, pos + 1)) break;
+               } else if(difference < 0) {
+                  // The queue is full
+                  return false;
+               } else {
+                  // Another thread claimed this cell first
+                  pos = m_enqueue_pos.load(std::memory_order_relaxed);
+               }
+            }
+            cell->retired = retired;
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+         }
+
+         // Only the reclamation thread pops from the queue
+         bool try_pop(Retired & retired) {
+            const std::size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            Cell & cell = m_cells[pos & m_mask];
+            if(cell.sequence.load(std::memory_order_acquire) != pos + 1) return false;
+            retired = cell.retired;
+            m_dequeue_pos.store(pos + 1);
+            cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+            return true;
+         }
+
+         void wake_up() {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            m_sleeping.store(false);
+            m_wake_condition.notify_one();
+         }
+
+         void reclamation_loop() {
+            while(true) {
+               // Destroy retired objects as long as there are some
+               Retired retired;
+               if(try_pop(retired)) {
+                  retired.destroy(retired.object);
+                  m_reclaimed_amount.fetch_add(1, std::memory_order_release);
+                  continue;
+               }
+
+               // Once the queue is drained, stop if requested, otherwise go to sleep. Retiring
+               // threads check the sleep flag after claiming a cell, and we check for claimed cells
+               // after raising it, so one of us is bound to notice the other.
+               if(m_stopping.load() && (m_dequeue_pos.load() == m_enqueue_pos.load())) break;
+               std::unique_lock<std::mutex> lock(m_wake_mutex);
+               m_sleeping.store(true);
+               if(m_dequeue_pos.load() == m_enqueue_pos.load() && !m_stopping.load()) {
+                  m_wake_condition.wait(lock, [this](){ return !m_sleeping.load(); });
+               }
+               m_sleeping.store(false);
+            }
+         }
+   };
+
+
+   // This deleter policy hands payloads over to the process-wide background reclaimer instead of
+   // deleting them on the spot. It is meant for large payloads whose teardown is expensive, such
+   // as trees which must be freed node by node.
+   template <typename T>
+   struct background_deleter {
+      void operator()(T * payload) const {
+         background_reclaimer::global().retire(payload);
+      }
+   };
+
+}
+
+#endif
@@ -0,0 +1,95 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef COW_HIERARCHY_H
+#define COW_HIERARCHY_H
+
+#include <cstddef>
+#include <unordered_set>
+
+#include "copy_on_write_ptr.hpp"
+
+// Payloads which hold copy-on-write pointers themselves form hierarchies, such as document trees.
+// Such payloads may specialize this trait so that tools which walk hierarchies, like
+// report_sharing() below, can find their children: visit() must call the visitor with every child
+// copy_on_write_ptr of the payload. By default, payloads have no children.
+template <typename T>
+struct cow_children {
+   template <typename Visitor>
+   static void visit(const T &, Visitor &&) { }
+};
+
+// How much of a hierarchy of payloads is still shared with other hierarchies. A payload counts as
+// shared if another pointer refers to it, or if it is nested within a shared payload. Note that
+// pointers may have given up ownership of payloads which are no longer shared, so this tells how
+// much memory the hierarchy shares rather than how much writing to it would copy.
+struct cow_sharing_report {
+   std::size_t payloads = 0;         // Distinct payloads reachable from the root
+   std::size_t shared_payloads = 0;  // Those of them which are shared
+   std::size_t depth = 0;            // Levels of payloads below the root pointer
+
+   double shared_fraction() const {
+      return (payloads == 0) ? 0.0 : static_cast<double>(shared_payloads) / payloads;
+   }
+};
+
+namespace cow_hierarchy_detail {
+
+   class SharingVisitor {
+      public:
+         SharingVisitor(cow_sharing_report & report,
+                        std::unordered_set<const void *> & visited,
+                        const bool shared_above,
+                        const std::size_t depth) :
+            m_report(report),
+            m_visited(visited),
+            m_shared_above{shared_above},
+            m_depth{depth}
+         { }
+
+         template <typename T, typename OwnershipFlag, typename Deleter>
+         void operator()(const copy_on_write_ptr<T, OwnershipFlag, Deleter> & pointer) const {
+            if(pointer.use_count() == 0) return;
+            const T & payload = pointer.read();
+            if(!m_visited.insert(&payload).second) return;
+
+            const bool shared = m_shared_above || (pointer.use_count() > 1);
+            ++m_report.payloads;
+            if(shared) ++m_report.shared_payloads;
+            if(m_depth + 1 > m_report.depth) m_report.depth = m_depth + 1;
+
+            cow_children<T>::visit(payload, SharingVisitor{m_report, m_visited, shared, m_depth + 1});
+         }
+
+      private:
+         cow_sharing_report & m_report;
+         std::unordered_set<const void *> & m_visited;
+         bool m_shared_above;
+         std::size_t m_depth;
+   };
+
+}
+
+// Walk a hierarchy of payloads and report how much of it is shared. This is a debugging tool: it
+// visits every payload, and must not run concurrently with writes to the hierarchy.
+template <typename T, typename OwnershipFlag, typename Deleter>
+cow_sharing_report report_sharing(const copy_on_write_ptr<T, OwnershipFlag, Deleter> & root) {
+   cow_sharing_report report;
+   std::unordered_set<const void *> visited;
+   cow_hierarchy_detail::SharingVisitor{report, visited, false, 0}(root);
+   return report;
+}
+
+#endif
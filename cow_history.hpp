@@ -0,0 +1,140 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef COW_HISTORY_H
+#define COW_HISTORY_H
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "copy_on_write_ptr.hpp"
+
+// The cow_history class keeps a bounded series of versioned snapshots of a copy-on-write value.
+// Taking a snapshot is a pointer copy, so versions which were not written to in between share
+// their payload, and the deep copy only happens once the live value is modified.
+template <typename T,
+          typename OwnershipFlag>
+class cow_history {
+   public:
+      using pointer = copy_on_write_ptr<T, OwnershipFlag>;
+      using version_id = std::size_t;
+
+
+      // === BASIC CLASS LIFECYCLE ===
+
+      // Start a history from a raw pointer, keeping at most max_versions snapshots around.
+      cow_history(T * initial_value, const std::size_t max_versions) :
+         m_current{initial_value},
+         m_snapshots{},
+         m_first_version{0},
+         m_max_versions{max_versions}
+      {
+         if(max_versions == 0) throw std::invalid_argument("A history must retain at least one version");
+      }
+
+
+      // === LIVE VALUE ACCESS ===
+
+      // The live value is accessed with the same semantics as a copy_on_write_ptr. A write which
+      // follows a snapshot triggers the lazy copy, leaving the snapshot untouched.
+      const T & read() const { return m_current.read(); }
+      void write(const T & value) { m_current.write(value); }
+      void write(T && value) { m_current.write(std::move(value)); }
+
+      // Modify the live value in place, so that a write which follows a snapshot costs a single
+      // lazy copy (see copy_on_write_ptr::modify())
+      template <typename Callable>
+      void modify(Callable && modifier) { m_current.modify(std::forward<Callable>(modifier)); }
+
+
+      // === VERSION MANAGEMENT ===
+
+      // Record the live value as a new version, in O(1). If more than max_versions snapshots are
+      // retained as a result, the oldest one is dropped, releasing its payload if it isn't shared.
+      version_id snapshot() {
+         m_snapshots.push_back(m_current);
+         if(m_snapshots.size() > m_max_versions) {
+            m_snapshots.pop_front();
+            ++m_first_version;
+         }
+         return newest_version();
+      }
+
+      // Restore the live value to a previously recorded version. This is also a pointer copy: the
+      // snapshot itself remains available, and will not be affected by subsequent writes.
+      void rollback(const version_id version) {
+         m_current = snapshot_at(version);
+      }
+
+      // Tell which versions are still retained. Version identifiers increase monotonically and are
+      // never reused, so an identifier always refers to the same state or to nothing. Before the
+      // first snapshot, no version is retained, and asking for the newest one is an error.
+      std::size_t size() const { return m_snapshots.size(); }
+      bool empty() const { return m_snapshots.empty(); }
+      std::size_t max_versions() const { return m_max_versions; }
+      version_id oldest_version() const { return m_first_version; }
+      version_id newest_version() const {
+         if(empty()) throw std::out_of_range("No version has been recorded yet");
+         return m_first_version + m_snapshots.size() - 1;
+      }
+      bool contains(const version_id version) const {
+         return (version >= m_first_version) && (version - m_first_version < m_snapshots.size());
+      }
+
+      // Read from a previously recorded version
+      const T & read(const version_id version) const { return snapshot_at(version).read(); }
+
+
+      // === SHARING DIAGNOSTICS ===
+
+      // Tell whether two retained versions still point to the same payload block
+      bool shares_payload(const version_id version1, const version_id version2) const {
+         return &read(version1) == &read(version2);
+      }
+
+      // Tell whether the live value still shares its payload with a retained version
+      bool current_shares_payload(const version_id version) const {
+         return &read() == &read(version);
+      }
+
+      // Count how many payload blocks are kept alive by the history, including the live value.
+      // Comparing this with size() + 1 tells how much memory structural sharing saves over
+      // deep-copying the value at every checkpoint.
+      std::size_t distinct_payloads() const {
+         std::vector<const T *> payloads;
+         payloads.reserve(m_snapshots.size() + 1);
+         payloads.push_back(&read());
+         for(const pointer & version : m_snapshots) payloads.push_back(&version.read());
+         std::sort(payloads.begin(), payloads.end());
+         return std::unique(payloads.begin(), payloads.end()) - payloads.begin();
+      }
+
+   private:
+      pointer m_current;
+      std::deque<pointer> m_snapshots;
+      version_id m_first_version;
+      std::size_t m_max_versions;
+
+      const pointer & snapshot_at(const version_id version) const {
+         if(!contains(version)) throw std::out_of_range("Requested version is not retained");
+         return m_snapshots[version - m_first_version];
+      }
+};
+
+#endif
@@ -0,0 +1,152 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef COW_INTERN_TABLE_H
+#define COW_INTERN_TABLE_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+// The cow_intern_table class deduplicates copy-on-write payloads by content (hash-consing). It maps
+// content hashes to weak references, so that it never keeps a payload alive on its own, and is
+// split into independently locked shards so that concurrent users rarely contend.
+//
+// Interned payloads are shared by construction, so they may only be modified through the lazy copy
+// of a copy_on_write_ptr. Clients must not keep other mutable references to them.
+//
+// A weak reference keeps the allocation of its payload's reference count alive until the entry is
+// cleaned up. For payloads made by std::make_shared, which copy_on_write_ptr uses for lazy copies,
+// that allocation also holds the payload object itself, destroyed but not freed. To bound this,
+// intern() sweeps a shard for expired entries whenever it has grown to twice its size after the
+// previous sweep, which keeps at most about as many expired entries around as there are live ones
+// at an amortized constant cost. purge() releases all of them at once.
+template <typename T,
+          typename Hash = std::hash<T>,
+          typename KeyEqual = std::equal_to<T>>
+class cow_intern_table {
+   public:
+      // === BASIC CLASS LIFECYCLE ===
+
+      // Create an empty table, optionally tuning the amount of shards for the expected concurrency
+      explicit cow_intern_table(const std::size_t shard_amount = 16,
+                                const Hash & hash = Hash{},
+                                const KeyEqual & key_equal = KeyEqual{}) :
+         m_shards{new Shard[shard_amount > 0 ? shard_amount : 1]},
+         m_shard_amount{shard_amount > 0 ? shard_amount : 1},
+         m_hash{hash},
+         m_key_equal{key_equal}
+      { }
+
+      // Sharing a table would be confusing, and moving it around while in use would be racy.
+      cow_intern_table(const cow_intern_table &) = delete;
+      cow_intern_table & operator=(const cow_intern_table &) = delete;
+
+
+      // === INTERNING ===
+
+      // Return the canonical payload with the same content as the input one. If there is no such
+      // payload yet, the input becomes the canonical one. Expired entries met along the way are
+      // cleaned up, and the whole shard is swept for them when it has grown enough.
+      std::shared_ptr<T> intern(const std::shared_ptr<T> & payload) {
+         const std::size_t hash = m_hash(*payload);
+         Shard & shard = m_shards[hash % m_shard_amount];
+         std::lock_guard<std::mutex> lock(shard.mutex);
+
+         auto candidates = shard.entries.equal_range(hash);
+         for(auto it = candidates.first; it != candidates.second; ) {
+            std::shared_ptr<T> candidate = it->second.lock();
+            if(!candidate) {
+               it = shard.entries.erase(it);
+            } else if((candidate == payload) || m_key_equal(*candidate, *payload)) {
+               return candidate;
+            } else {
+               ++it;
+            }
+         }
+
+         shard.entries.emplace(hash, payload);
+         if(shard.entries.size() >= shard.sweep_threshold) {
+            sweep(shard);
+            const std::size_t doubled_size = 2 * shard.entries.size();
+            shard.sweep_threshold = (doubled_size > MinSweepThreshold) ? doubled_size : MinSweepThreshold;
+         }
+         return payload;
+      }
+
+
+      // === MAINTENANCE ===
+
+      // Drop all entries whose payload has been released, and tell how many there were. Expired
+      // entries are also cleaned up lazily by intern(), so this is only needed to release all of
+      // them at once, e.g. after many payloads of distinct content have come and gone.
+      std::size_t purge() {
+         std::size_t purged = 0;
+         for(std::size_t i = 0; i < m_shard_amount; ++i) {
+            Shard & shard = m_shards[i];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            purged += sweep(shard);
+         }
+         return purged;
+      }
+
+      // Tell how many distinct payloads are currently registered. Entries which expired but were
+      // not purged yet are not counted.
+      std::size_t size() const {
+         std::size_t live = 0;
+         for(std::size_t i = 0; i < m_shard_amount; ++i) {
+            const Shard & shard = m_shards[i];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for(const auto & entry : shard.entries) {
+               if(!entry.second.expired()) ++live;
+            }
+         }
+         return live;
+      }
+
+   private:
+      // Shards are not swept before they hold this many entries, so that small ones aren't swept
+      // on every insertion
+      static const std::size_t MinSweepThreshold = 64;
+
+      struct Shard {
+         mutable std::mutex mutex;
+         std::unordered_multimap<std::size_t, std::weak_ptr<T>> entries;
+         std::size_t sweep_threshold = MinSweepThreshold;
+      };
+
+      // Drop the expired entries of a shard, whose lock must be held, and tell how many there were
+      static std::size_t sweep(Shard & shard) {
+         std::size_t swept = 0;
+         for(auto it = shard.entries.begin(); it != shard.entries.end(); ) {
+            if(it->second.expired()) {
+               it = shard.entries.erase(it);
+               ++swept;
+            } else {
+               ++it;
+            }
+         }
+         return swept;
+      }
+
+      std::unique_ptr<Shard[]> m_shards;
+      std::size_t m_shard_amount;
+      Hash m_hash;
+      KeyEqual m_key_equal;
+};
+
+#endif
@@ -0,0 +1,259 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef AWAITABLE_ATOMICS_FLAG_H
+#define AWAITABLE_ATOMICS_FLAG_H
+
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#ifdef __cpp_impl_coroutine
+#include <coroutine>
+#endif
+
+namespace cow_ownership_flags {
+
+   // This implementation of the copy-on-write ownership flag follows the same protocol as the
+   // manually ordered atomics flag, but also lets C++20 coroutines wait for ownership acquisition
+   // by suspending themselves instead of spinning. To this end, while ownership is being acquired,
+   // the status word doubles as the head of an intrusive stack of suspended coroutines. Once it is
+   // done, the acquiring thread hands them over to the schedulers which they provided.
+   class awaitable_atomics_flag {
+      private:
+
+         // The status word is either one of the OwnershipStatus values below, or, while ownership
+         // is being acquired and some coroutines are waiting for it, a pointer to the last Waiter.
+         using StatusWord = std::uintptr_t;
+         enum OwnershipStatus : StatusWord { NotOwner, Owner, AcquiringOwnership };
+
+         struct Waiter {
+#ifdef __cpp_impl_coroutine
+            std::coroutine_handle<> handle;
+            void (*schedule)(const void * scheduler, std::coroutine_handle<> handle);
+            const void * scheduler;
+#endif
+            Waiter * next;
+         };
+         static_assert(alignof(Waiter) > AcquiringOwnership, "Waiter addresses must not alias status values");
+
+      public:
+
+         // Ownership flags may be initialized to a certain value without synchronization, as at
+         // construction time only one thread has access to the active ownership flag.
+         awaitable_atomics_flag(bool initially_owned) :
+            m_ownership_status{to_ownership_status(initially_owned)}
+         { }
+
+
+         // When we move-construct from an ownership flag rvalue, we may assume that no other thread
+         // has access to either that rvalue or the active flag, and avoid using synchronization.
+         awaitable_atomics_flag(awaitable_atomics_flag && other) :
+            m_ownership_status{other.unsynchronized_status()}
+         { }
+
+
+         // There's nothing special about deleting an ownership flag.
+         ~awaitable_atomics_flag() = default;
+
+
+         // When we move-assign an ownership flag rvalue, no other thread has access to that rvalue,
+         // so we can access it without read synchronization.
+         // But the active flag may be shared with other threads, so we need write synchronization.
+         awaitable_atomics_flag & operator=(awaitable_atomics_flag && other) {
+            set_ownership_status(other.unsynchronized_status());
+            return *this;
+         }
+
+
+         // Ownership flags are not copyable. Proper CoW semantics would require clearing them upon
+         // copy, which is at odds with normal copy semantics. It's better to throw a compiler error
+         // in this case, and let the user write more explicit code.
+         awaitable_atomics_flag(const awaitable_atomics_flag &) = delete;
+         awaitable_atomics_flag & operator=(const awaitable_atomics_flag &) = delete;
+
+
+         // Authoritatively mark the active memory block as owned/not owned by the active thread.
+         void set_ownership(bool owned) {
+            set_ownership_status(to_ownership_status(owned));
+         }
+
+
+         // Acquire ownership of the active memory block, using the provided resource acquisition
+         // routine, if that's not done already. Other threads should block during this process.
+         template<typename Callable>
+         void acquire_ownership_once(Callable && acquisition_routine) {
+            acquire_ownership_once(acquisition_routine, [](){});
+         }
+
+
+         // Same as above, but blocked threads repeatedly call the provided waiting routine, which
+         // may for example help the acquiring thread with its work.
+         template<typename Callable, typename WaitingRoutine>
+         void acquire_ownership_once(Callable && acquisition_routine, WaitingRoutine && waiting_routine) {
+            if(!try_acquire_ownership_once(acquisition_routine)) {
+               while(is_acquiring(m_ownership_status.load(std::memory_order_acquire))) waiting_routine();
+            }
+         }
+
+
+         // Acquire ownership of the active memory block if that's not done already, like above,
+         // but do not block if another thread is in the process of doing so. Tell whether we own
+         // the memory block in the end.
+         template<typename Callable>
+         bool try_acquire_ownership_once(Callable && acquisition_routine) {
+            StatusWord previous_ownership = NotOwner;
+            if(m_ownership_status.compare_exchange_strong(previous_ownership,
+                                                          AcquiringOwnership,
+                                                          std::memory_order_acq_rel,
+                                                          std::memory_order_acquire)) {
+               acquisition_routine();
+               finish_acquisition();
+               return true;
+            }
+            return !is_acquiring(previous_ownership);
+         }
+
+
+#ifdef __cpp_impl_coroutine
+         // Awaitable version of acquire_ownership_once(). Awaiting coroutines are suspended while
+         // another thread acquires ownership. Once it's done, that thread calls the scheduler with
+         // the handle of each suspended coroutine. The scheduler is a copyable callable which should
+         // arrange for the coroutine to be resumed later on, e.g. by posting it to an executor.
+         // Resuming it inline would run it on the acquiring thread before that thread is done with
+         // its own work, such as writing to the payload which it just copied.
+         template<typename Callable, typename Scheduler>
+         class ownership_awaiter {
+            public:
+               ownership_awaiter(awaitable_atomics_flag & flag, Callable acquisition_routine, Scheduler scheduler) :
+                  m_flag(flag),
+                  m_acquisition_routine(std::move(acquisition_routine)),
+                  m_scheduler(std::move(scheduler))
+               { }
+
+               // If nobody else is acquiring ownership, there's no need to suspend
+               bool await_ready() {
+                  return m_flag.try_acquire_ownership_once(m_acquisition_routine);
+               }
+
+               // Otherwise, push ourselves on the waiter stack. The status may have changed since
+               // await_ready(), in which case we go on without suspending.
+               bool await_suspend(std::coroutine_handle<> handle) {
+                  m_waiter.handle = handle;
+                  m_waiter.schedule = &schedule;
+                  m_waiter.scheduler = &m_scheduler;
+                  StatusWord status = m_flag.m_ownership_status.load(std::memory_order_acquire);
+                  while(true) {
+                     if(status == Owner) return false;
+                     if(status == NotOwner) {
+                        if(m_flag.try_acquire_ownership_once(m_acquisition_routine)) return false;
+                        status = m_flag.m_ownership_status.load(std::memory_order_acquire);
+                        continue;
+                     }
+                     m_waiter.next = (status == AcquiringOwnership) ? nullptr : reinterpret_cast<Waiter *>(status);
+                     if(m_flag.m_ownership_status.compare_exchange_weak(status,
+                                                                        reinterpret_cast<StatusWord>(&m_waiter),
+                                                                        std::memory_order_release,
+                                                                        std::memory_order_acquire)) {
+                        return true;
+                     }
+                  }
+               }
+
+               void await_resume() { }
+
+            private:
+               awaitable_atomics_flag & m_flag;
+               Callable m_acquisition_routine;
+               Scheduler m_scheduler;
+               Waiter m_waiter;
+
+               // The coroutine may be resumed, and destroy this awaiter, as soon as the scheduler
+               // gets its handle. So the scheduler is copied out of the awaiter before being called.
+               static void schedule(const void * scheduler, std::coroutine_handle<> handle) {
+                  Scheduler scheduler_copy = *static_cast<const Scheduler *>(scheduler);
+                  scheduler_copy(handle);
+               }
+         };
+
+         template<typename Callable, typename Scheduler>
+         ownership_awaiter<typename std::decay<Callable>::type, typename std::decay<Scheduler>::type>
+         async_acquire_ownership_once(Callable && acquisition_routine, Scheduler && scheduler) {
+            return {*this, std::forward<Callable>(acquisition_routine), std::forward<Scheduler>(scheduler)};
+         }
+#endif
+
+
+      private:
+
+         std::atomic<StatusWord> m_ownership_status;
+
+         static StatusWord to_ownership_status(bool is_owned) {
+            return (is_owned ? Owner : NotOwner);
+         }
+
+         static bool is_acquiring(StatusWord status) {
+            return status >= AcquiringOwnership;
+         }
+
+         StatusWord unsynchronized_status() {
+            return m_ownership_status.load(std::memory_order_relaxed);
+         }
+
+         // Mark ownership as acquired, then schedule suspended coroutines in order of arrival
+         void finish_acquisition() {
+            const StatusWord waiters = m_ownership_status.exchange(Owner, std::memory_order_acq_rel);
+            if(waiters == AcquiringOwnership) return;
+
+            Waiter * reversed = nullptr;
+            for(Waiter * waiter = reinterpret_cast<Waiter *>(waiters); waiter != nullptr; ) {
+               Waiter * next = waiter->next;
+               waiter->next = reversed;
+               reversed = waiter;
+               waiter = next;
+            }
+
+#ifdef __cpp_impl_coroutine
+            // A scheduled coroutine may finish and destroy its waiter, so read links beforehand
+            while(reversed != nullptr) {
+               Waiter * next = reversed->next;
+               reversed->schedule(reversed->scheduler, reversed->handle);
+               reversed = next;
+            }
+#endif
+         }
+
+         void set_ownership_status(const StatusWord desired_ownership) {
+            StatusWord current_ownership = m_ownership_status.load(std::memory_order_acquire);
+
+            do {
+               // Wait for any resource ownership acquisition operation to complete
+               while(is_acquiring(current_ownership)) {
+                  current_ownership = m_ownership_status.load(std::memory_order_acquire);
+               }
+
+               // Once that is done, try to swap in the new resource ownership status
+            } while(!m_ownership_status.compare_exchange_weak(current_ownership,
+                                                              desired_ownership,
+                                                              std::memory_order_acq_rel,
+                                                              std::memory_order_acquire));
+         }
+
+   };
+
+}
+
+#endif
@@ -0,0 +1,238 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef BIASED_ATOMICS_FLAG_H
+#define BIASED_ATOMICS_FLAG_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace cow_ownership_flags {
+
+   // This implementation of the copy-on-write ownership flag is biased towards the thread which
+   // created it, in the spirit of biased locking. Most copy-on-write pointers are only ever used
+   // by one thread, and that thread should not pay for synchronization it does not need.
+   //
+   // Warm writes and no-op ownership changes, by far the most common operations, do not change
+   // the status at all. They only need an acquire load of the status word, which is a plain load on
+   // x86 and cheap elsewhere, so they are about as fast as with the thread-unsafe flag on every
+   // thread, bias or not.
+   //
+   // Actual status changes are where the bias matters. The first time another thread needs one,
+   // it revokes the bias for good by setting a sticky bit in the status word, and all threads
+   // synchronize like the manually ordered atomics flag from then on. Until then, the biased thread
+   // reads the status word without ordering. Since that bit is set by the same atomic variable
+   // which holds the status, the biased thread cannot observe a status change made by another
+   // thread without noticing that the bias was revoked.
+   //
+   // Unlike a JVM, we cannot stop the biased thread to revoke its bias, so that thread must still
+   // use atomic read-modify-write operations when it actually changes the ownership status.
+   class biased_atomics_flag {
+      public:
+
+         // Ownership flags may be initialized to a certain value without synchronization, as at
+         // construction time only one thread has access to the active ownership flag. The flag is
+         // biased towards the constructing thread.
+         biased_atomics_flag(bool initially_owned) :
+            m_status_word{to_ownership_status(initially_owned)},
+            m_biased_thread{current_thread_tag()}
+         { }
+
+
+         // When we move-construct from an ownership flag rvalue, we may assume that no other thread
+         // has access to either that rvalue or the active flag, and avoid using synchronization.
+         // The new flag is biased towards the thread which performs the move.
+         biased_atomics_flag(biased_atomics_flag && other) :
+            m_status_word{other.unsynchronized_status()},
+            m_biased_thread{current_thread_tag()}
+         { }
+
+
+         // There's nothing special about deleting an ownership flag.
+         ~biased_atomics_flag() = default;
+
+
+         // When we move-assign an ownership flag rvalue, no other thread has access to that rvalue,
+         // so we can access it without read synchronization.
+         // But the active flag may be shared with other threads, so we need write synchronization.
+         biased_atomics_flag & operator=(biased_atomics_flag && other) {
+            set_ownership_status(other.unsynchronized_status());
+            return *this;
+         }
+
+
+         // Ownership flags are not copyable. Proper CoW semantics would require clearing them upon
+         // copy, which is at odds with normal copy semantics. It's better to throw a compiler error
+         // in this case, and let the user write more explicit code.
+         biased_atomics_flag(const biased_atomics_flag &) = delete;
+         biased_atomics_flag & operator=(const biased_atomics_flag &) = delete;
+
+
+         // Authoritatively mark the active memory block as owned/not owned by the active thread.
+         void set_ownership(bool owned) {
+            set_ownership_status(to_ownership_status(owned));
+         }
+
+
+         // Acquire ownership of the active memory block, using the provided resource acquisition
+         // routine, if that's not done already. Other threads should block during this process.
+         template<typename Callable>
+         void acquire_ownership_once(Callable && acquisition_routine) {
+            acquire_ownership_once(acquisition_routine, [](){});
+         }
+
+
+         // Same as above, but blocked threads repeatedly call the provided waiting routine, which
+         // may for example help the acquiring thread with its work.
+         template<typename Callable, typename WaitingRoutine>
+         void acquire_ownership_once(Callable && acquisition_routine, WaitingRoutine && waiting_routine) {
+            if(!try_acquire_ownership_once(acquisition_routine)) {
+               // Wait for another thread's ownership acquisition
+               while(status_of(m_status_word.load(std::memory_order_acquire)) == AcquiringOwnership) {
+                  waiting_routine();
+               }
+            }
+         }
+
+
+         // Acquire ownership of the active memory block if that's not done already, like above,
+         // but do not block if another thread is in the process of doing so. Tell whether we own
+         // the memory block in the end.
+         template<typename Callable>
+         bool try_acquire_ownership_once(Callable && acquisition_routine) {
+            // Warm path: whichever thread made us owner released the status, so it's enough to
+            // acquire it, without checking which thread we are or touching the bias.
+            if(!is_owned(m_status_word.load(std::memory_order_acquire))) {
+               return try_acquire_ownership_slow(acquisition_routine);
+            }
+            return true;
+         }
+
+
+      private:
+
+         // The two low-order bits of the status word hold the ownership status, and the next bit
+         // tells whether the bias was revoked.
+         using StatusWord = std::uint_fast8_t;
+         enum OwnershipStatus : StatusWord { NotOwner, AcquiringOwnership, Owner };
+         static const StatusWord StatusMask = 0x3;
+         static const StatusWord BiasRevoked = 0x4;
+
+         std::atomic<StatusWord> m_status_word;
+         const void * const m_biased_thread;
+
+         // Cold path of try_acquire_ownership_once(), kept apart so that the warm path stays small
+         // enough to be inlined into every write.
+         template<typename Callable>
+         bool try_acquire_ownership_slow(Callable && acquisition_routine) {
+            StatusWord current_word = load_status_word();
+            while(true) {
+               switch(status_of(current_word)) {
+                  case NotOwner:  // Try to switch to AcquiringOwnership, keeping the bias bit as is
+                     if(m_status_word.compare_exchange_weak(current_word,
+                                                            with_status(current_word, AcquiringOwnership),
+                                                            std::memory_order_acq_rel,
+                                                            std::memory_order_acquire)) {
+                        acquisition_routine();
+
+                        // Another thread may revoke the bias meanwhile, so flip the status bits
+                        // from AcquiringOwnership to Owner without touching the others.
+                        m_status_word.fetch_xor(AcquiringOwnership ^ Owner, std::memory_order_release);
+                        return true;
+                     }
+                     break;
+
+                  case AcquiringOwnership:  // Another thread is busy acquiring ownership, give up
+                     return false;
+
+                  default:  // Another thread made us owner meanwhile
+                     return true;
+               }
+            }
+         }
+
+         // Threads are told apart by the address of a thread-local variable, which is much cheaper
+         // to compute than std::this_thread::get_id() on common platforms.
+         static const void * current_thread_tag() {
+            static thread_local const char tag = 0;
+            return &tag;
+         }
+
+         static StatusWord to_ownership_status(bool is_owned) {
+            return (is_owned ? Owner : NotOwner);
+         }
+
+         static StatusWord status_of(const StatusWord word) {
+            return word & StatusMask;
+         }
+
+         // Owner is the only status with its second bit set, so this is a single bit test
+         static bool is_owned(const StatusWord word) {
+            return (word & Owner) != 0;
+         }
+
+         static StatusWord with_status(const StatusWord word, const StatusWord status) {
+            return (word & ~StatusMask) | status;
+         }
+
+         StatusWord unsynchronized_status() {
+            return status_of(m_status_word.load(std::memory_order_relaxed));
+         }
+
+         // Read the status word before changing it. While the bias holds, the biased thread made
+         // all status changes itself and needs no synchronization. Any other thread revokes the
+         // bias first.
+         StatusWord load_status_word() {
+            StatusWord word = m_status_word.load(std::memory_order_relaxed);
+            if(!(word & BiasRevoked)) {
+               if(current_thread_tag() == m_biased_thread) return word;
+               word = m_status_word.fetch_or(BiasRevoked, std::memory_order_acq_rel) | BiasRevoked;
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return word;
+         }
+
+         void set_ownership_status(const StatusWord desired_ownership) {
+            // Setting the ownership status to its current value is a no-op, which is common when
+            // copy-assigning pointers which were already shared. Like warm writes, this only needs
+            // to acquire the status, whichever thread we are.
+            if(status_of(m_status_word.load(std::memory_order_acquire)) != desired_ownership) {
+               change_ownership_status(desired_ownership);
+            }
+         }
+
+         // Cold path of set_ownership_status(), which actually changes the status
+         void change_ownership_status(const StatusWord desired_ownership) {
+            StatusWord current_word = load_status_word();
+            if(status_of(current_word) == desired_ownership) return;
+
+            do {
+               // Wait for any resource ownership acquisition operation to complete
+               while(status_of(current_word) == AcquiringOwnership) {
+                  current_word = m_status_word.load(std::memory_order_acquire);
+               }
+
+               // Once that is done, try to swap in the new resource ownership status
+            } while(!m_status_word.compare_exchange_weak(current_word,
+                                                         with_status(current_word, desired_ownership),
+                                                         std::memory_order_acq_rel,
+                                                         std::memory_order_acquire));
+         }
+
+   };
+
+}
+
+#endif
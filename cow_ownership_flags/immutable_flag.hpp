@@ -0,0 +1,48 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef IMMUTABLE_FLAG_H
+#define IMMUTABLE_FLAG_H
+
+namespace cow_ownership_flags {
+
+   // This ownership flag is meant for payloads which are always shared and never written to. It
+   // holds no state, and does not support ownership acquisition, so copy_on_write_ptrs which use
+   // it are read-only: calling write() on them fails to compile. As the flag is stored as an empty
+   // base, such pointers are exactly as large as an std::shared_ptr.
+   class immutable_flag {
+      public:
+
+         // The initial ownership status does not matter, as nobody ever writes
+         immutable_flag(bool) { }
+
+         // There is no state to move, and nothing special about deleting an ownership flag
+         immutable_flag(immutable_flag &&) { }
+         ~immutable_flag() = default;
+         immutable_flag & operator=(immutable_flag &&) { return *this; }
+
+         // Ownership flags are not copyable. Proper CoW semantics would require clearing them upon
+         // copy, which is at odds with normal copy semantics. It's better to throw a compiler error
+         // in this case, and let the user write more explicit code.
+         immutable_flag(const immutable_flag &) = delete;
+         immutable_flag & operator=(const immutable_flag &) = delete;
+
+         // Giving up ownership, as copies do, is a no-op
+         void set_ownership(bool) { }
+   };
+
+}
+
+#endif
@@ -49,6 +49,7 @@ namespace cow_ownership_flags {
          // But the active flag may be shared with other threads, so we need write synchronization.
          manually_ordered_atomics_flag & operator=(manually_ordered_atomics_flag && other) {
             set_ownership_status(other.unsynchronized_status());
+            return *this;
          }
          
          
@@ -69,6 +70,14 @@ namespace cow_ownership_flags {
          // routine, if that's not done already. Other threads should block during this process.
          template<typename Callable>
          void acquire_ownership_once(Callable && acquisition_routine) {
+            acquire_ownership_once(acquisition_routine, [](){});
+         }
+         
+         
+         // Same as above, but blocked threads repeatedly call the provided waiting routine, which
+         // may for example help the acquiring thread with its work.
+         template<typename Callable, typename WaitingRoutine>
+         void acquire_ownership_once(Callable && acquisition_routine, WaitingRoutine && waiting_routine) {
             // Try to switch the ownership status from NotOwner to AcquiringOwnership
             // and tell previous ownership status
             OwnershipStatusType previous_ownership = NotOwner;
@@ -86,7 +95,7 @@ namespace cow_ownership_flags {
                   break;
                   
                case AcquiringOwnership:  // Wait for ownership acquisition
-                  while(m_ownership_status.load(std::memory_order_acquire) != Owner);
+                  while(m_ownership_status.load(std::memory_order_acquire) != Owner) waiting_routine();
                   break;
                   
                case Owner:  // Nothing to do, we already own the resource
@@ -95,6 +104,33 @@ namespace cow_ownership_flags {
          }
          
          
+         // Acquire ownership of the active memory block if that's not done already, like above,
+         // but do not block if another thread is in the process of doing so. Tell whether we own
+         // the memory block in the end.
+         template<typename Callable>
+         bool try_acquire_ownership_once(Callable && acquisition_routine) {
+            OwnershipStatusType previous_ownership = NotOwner;
+            m_ownership_status.compare_exchange_strong(previous_ownership,
+                                                       AcquiringOwnership,
+                                                       std::memory_order_acq_rel,
+                                                       std::memory_order_acquire);
+            
+            switch(previous_ownership) {
+               case NotOwner:  // Acquire resource ownership
+                  acquisition_routine();
+                  m_ownership_status.store(Owner,
+                                           std::memory_order_release);
+                  return true;
+                  
+               case AcquiringOwnership:  // Another thread is busy acquiring ownership, give up
+                  return false;
+                  
+               default:  // We already own the resource
+                  return true;
+            }
+         }
+         
+         
       private:
       
          using OwnershipStatusType = std::uint_fast8_t;
@@ -40,6 +40,7 @@ namespace cow_ownership_flags {
          // But the active flag may be shared with other threads, so we need write synchronization.
          mutex_flag & operator=(mutex_flag && other) {
             set_ownership(other.m_owned);
+            return *this;
          }
          
          // Ownership flags are not copyable. Proper CoW semantics would require clearing them upon
@@ -65,6 +66,26 @@ namespace cow_ownership_flags {
             }
          }
          
+         // Same as above, but blocked threads repeatedly call the provided waiting routine, which
+         // may for example help the acquiring thread with its work.
+         template<typename Callable, typename WaitingRoutine>
+         void acquire_ownership_once(Callable && acquire, WaitingRoutine && waiting_routine) {
+            while(!try_acquire_ownership_once(acquire)) waiting_routine();
+         }
+         
+         // Acquire ownership without blocking. If the mutex is busy, which usually means that another
+         // thread is acquiring ownership, give up and return false.
+         template<typename Callable>
+         bool try_acquire_ownership_once(Callable && acquire) {
+            std::unique_lock<std::mutex> lock(m_ownership_mutex, std::try_to_lock);
+            if(!lock.owns_lock()) return false;
+            if(!m_owned) {
+               acquire();
+               m_owned = true;
+            }
+            return true;
+         }
+         
       private:
       
          std::mutex m_ownership_mutex;
@@ -0,0 +1,96 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef OWNERSHIP_FLAG_TRAITS_H
+#define OWNERSHIP_FLAG_TRAITS_H
+
+#include <type_traits>
+#include <utility>
+
+namespace cow_ownership_flags {
+
+   namespace detail {
+
+      // Stand-ins for the resource acquisition and waiting routines which flags are given
+      struct Routine {
+         void operator()() const { }
+      };
+
+      template <typename Flag>
+      auto check_set_ownership(int) -> decltype(std::declval<Flag &>().set_ownership(true), std::true_type{});
+      template <typename Flag>
+      std::false_type check_set_ownership(...);
+
+      template <typename Flag>
+      auto check_acquire_ownership_once(int) -> decltype(std::declval<Flag &>().acquire_ownership_once(Routine{}), std::true_type{});
+      template <typename Flag>
+      std::false_type check_acquire_ownership_once(...);
+
+      template <typename Flag>
+      auto check_waiting_acquire_ownership_once(int) -> decltype(std::declval<Flag &>().acquire_ownership_once(Routine{}, Routine{}), std::true_type{});
+      template <typename Flag>
+      std::false_type check_waiting_acquire_ownership_once(...);
+
+      template <typename Flag>
+      auto check_try_acquire_ownership_once(int) -> typename std::is_convertible<decltype(std::declval<Flag &>().try_acquire_ownership_once(Routine{})), bool>::type;
+      template <typename Flag>
+      std::false_type check_try_acquire_ownership_once(...);
+
+   }
+
+   // Compile-time description of what an ownership flag policy supports. All flags must be
+   // constructible from their initial ownership status, movable, and let their status be set.
+   // Flags which support writes must also let ownership be acquired, with all the variants below.
+   // Flags which do not, such as immutable_flag, make for read-only pointers.
+   template <typename Flag>
+   struct ownership_flag_traits {
+      static const bool is_constructible_from_status = std::is_constructible<Flag, bool>::value;
+      static const bool is_movable = std::is_move_constructible<Flag>::value && std::is_move_assignable<Flag>::value;
+      static const bool has_set_ownership = decltype(detail::check_set_ownership<Flag>(0))::value;
+
+      static const bool has_acquire_ownership_once = decltype(detail::check_acquire_ownership_once<Flag>(0))::value;
+      static const bool has_waiting_acquire_ownership_once = decltype(detail::check_waiting_acquire_ownership_once<Flag>(0))::value;
+      static const bool has_try_acquire_ownership_once = decltype(detail::check_try_acquire_ownership_once<Flag>(0))::value;
+
+      static const bool supports_writes = has_acquire_ownership_once &&
+                                          has_waiting_acquire_ownership_once &&
+                                          has_try_acquire_ownership_once;
+      static const bool supports_some_writes = has_acquire_ownership_once ||
+                                               has_waiting_acquire_ownership_once ||
+                                               has_try_acquire_ownership_once;
+   };
+
+   // Instantiating this checks that a flag fulfills the requirements of the policy interface,
+   // with a readable error message for each missing part.
+   template <typename Flag, bool RequireWrites>
+   struct check_ownership_flag {
+      using traits = ownership_flag_traits<Flag>;
+      static_assert(traits::is_constructible_from_status,
+                    "Ownership flags must be constructible from their initial ownership status (bool)");
+      static_assert(traits::is_movable,
+                    "Ownership flags must be move-constructible and move-assignable");
+      static_assert(traits::has_set_ownership,
+                    "Ownership flags must provide set_ownership(bool)");
+      static_assert(traits::supports_writes || !traits::supports_some_writes,
+                    "Ownership flags must provide acquire_ownership_once(routine), acquire_ownership_once(routine, "
+                    "waiting_routine) and try_acquire_ownership_once(routine) -> bool, or none of them");
+      static_assert(traits::supports_writes || !RequireWrites,
+                    "This pointer type needs to write, so its ownership flag must support ownership acquisition");
+      static const bool value = true;
+   };
+
+}
+
+#endif
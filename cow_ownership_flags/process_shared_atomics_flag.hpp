@@ -0,0 +1,162 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef PROCESS_SHARED_ATOMICS_FLAG_H
+#define PROCESS_SHARED_ATOMICS_FLAG_H
+
+#include <atomic>
+#include <thread>
+#include <type_traits>
+
+namespace cow_ownership_flags {
+
+   // This implementation of the copy-on-write ownership flag follows the same protocol as the
+   // manually ordered atomics flag, but may also be placed in memory which is shared between
+   // processes (see cow_shared_memory.hpp). This requires an address-free atomic status, which
+   // lock-free atomics are in practice, and no reference to process-local state such as thread
+   // identifiers or pointers. A zero-filled flag, as found in a freshly created segment, is valid
+   // and not owned.
+   //
+   // Since the process which acquires ownership may have to do a lot of work (such as loading a
+   // dataset) and may even be descheduled for a while, waiting processes yield instead of spinning.
+   // If a process dies while acquiring ownership, waiting processes will wait forever.
+   class process_shared_atomics_flag {
+      public:
+
+         // Ownership flags may be initialized to a certain value without synchronization, as at
+         // construction time only one thread has access to the active ownership flag.
+         process_shared_atomics_flag(bool initially_owned) :
+            m_ownership_status{to_ownership_status(initially_owned)}
+         { }
+
+
+         // When we move-construct from an ownership flag rvalue, we may assume that no other thread
+         // has access to either that rvalue or the active flag, and avoid using synchronization.
+         process_shared_atomics_flag(process_shared_atomics_flag && other) :
+            m_ownership_status{other.unsynchronized_status()}
+         { }
+
+
+         // There's nothing special about deleting an ownership flag.
+         ~process_shared_atomics_flag() = default;
+
+
+         // When we move-assign an ownership flag rvalue, no other thread has access to that rvalue,
+         // so we can access it without read synchronization.
+         // But the active flag may be shared with other threads, so we need write synchronization.
+         process_shared_atomics_flag & operator=(process_shared_atomics_flag && other) {
+            set_ownership_status(other.unsynchronized_status());
+            return *this;
+         }
+
+
+         // Ownership flags are not copyable. Proper CoW semantics would require clearing them upon
+         // copy, which is at odds with normal copy semantics. It's better to throw a compiler error
+         // in this case, and let the user write more explicit code.
+         process_shared_atomics_flag(const process_shared_atomics_flag &) = delete;
+         process_shared_atomics_flag & operator=(const process_shared_atomics_flag &) = delete;
+
+
+         // Authoritatively mark the active memory block as owned/not owned by the active thread.
+         void set_ownership(bool owned) {
+            set_ownership_status(to_ownership_status(owned));
+         }
+
+
+         // Acquire ownership of the active memory block, using the provided resource acquisition
+         // routine, if that's not done already. Other threads and processes block in the meantime.
+         template<typename Callable>
+         void acquire_ownership_once(Callable && acquisition_routine) {
+            acquire_ownership_once(acquisition_routine, [](){ std::this_thread::yield(); });
+         }
+
+
+         // Same as above, but blocked threads repeatedly call the provided waiting routine, which
+         // may for example help the acquiring thread with its work.
+         template<typename Callable, typename WaitingRoutine>
+         void acquire_ownership_once(Callable && acquisition_routine, WaitingRoutine && waiting_routine) {
+            if(!try_acquire_ownership_once(acquisition_routine)) {
+               while(m_ownership_status.load(std::memory_order_acquire) != Owner) waiting_routine();
+            }
+         }
+
+
+         // Acquire ownership of the active memory block if that's not done already, like above,
+         // but do not block if another thread is in the process of doing so. Tell whether we own
+         // the memory block in the end.
+         template<typename Callable>
+         bool try_acquire_ownership_once(Callable && acquisition_routine) {
+            OwnershipStatusType previous_ownership = NotOwner;
+            m_ownership_status.compare_exchange_strong(previous_ownership,
+                                                       AcquiringOwnership,
+                                                       std::memory_order_acq_rel,
+                                                       std::memory_order_acquire);
+
+            switch(previous_ownership) {
+               case NotOwner:  // Acquire resource ownership
+                  acquisition_routine();
+                  m_ownership_status.store(Owner, std::memory_order_release);
+                  return true;
+
+               case AcquiringOwnership:  // Someone else is busy acquiring ownership, give up
+                  return false;
+
+               default:  // We already own the resource
+                  return true;
+            }
+         }
+
+
+      private:
+
+         // A plain int-sized status is lock-free on every platform which we care about
+         using OwnershipStatusType = unsigned;
+         static_assert(ATOMIC_INT_LOCK_FREE == 2, "Process-shared flags require lock-free atomics");
+         enum OwnershipStatus : OwnershipStatusType { NotOwner, AcquiringOwnership, Owner };
+         std::atomic<OwnershipStatusType> m_ownership_status;
+
+         static OwnershipStatusType to_ownership_status(bool is_owned) {
+            return (is_owned ? Owner : NotOwner);
+         }
+
+         OwnershipStatusType unsynchronized_status() {
+            return m_ownership_status.load(std::memory_order_relaxed);
+         }
+
+         void set_ownership_status(const OwnershipStatusType desired_ownership) {
+            OwnershipStatusType current_ownership = m_ownership_status.load(std::memory_order_acquire);
+
+            do {
+               // Wait for any resource ownership acquisition operation to complete
+               while(current_ownership == AcquiringOwnership) {
+                  std::this_thread::yield();
+                  current_ownership = m_ownership_status.load(std::memory_order_acquire);
+               }
+
+               // Once that is done, try to swap in the new resource ownership status
+            } while(!m_ownership_status.compare_exchange_weak(current_ownership,
+                                                              desired_ownership,
+                                                              std::memory_order_acq_rel,
+                                                              std::memory_order_acquire));
+         }
+
+   };
+
+   static_assert(std::is_standard_layout<process_shared_atomics_flag>::value,
+                 "Process-shared flags must have a layout which all processes agree on");
+
+}
+
+#endif
@@ -36,6 +36,7 @@ namespace cow_ownership_flags {
          // Move-assign the flag. Without thread safety, this is equivalent to move-construction.
          thread_unsafe_flag & operator=(thread_unsafe_flag && other) {
             set_ownership(other.m_owned);
+            return *this;
          }
          
          // Ownership flags are not copyable. Proper CoW semantics would require clearing them upon
@@ -60,6 +61,19 @@ namespace cow_ownership_flags {
             }
          }
          
+         // Without concurrency, nobody ever waits, so the waiting routine is never called.
+         template<typename Callable, typename WaitingRoutine>
+         void acquire_ownership_once(Callable && acquire, WaitingRoutine &&) {
+            acquire_ownership_once(acquire);
+         }
+         
+         // Acquire ownership without blocking. Without concurrency, this always succeeds.
+         template<typename Callable>
+         bool try_acquire_ownership_once(Callable && acquire) {
+            acquire_ownership_once(acquire);
+            return true;
+         }
+         
       private:
       
          bool m_owned;
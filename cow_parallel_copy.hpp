@@ -0,0 +1,352 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef COW_PARALLEL_COPY_H
+#define COW_PARALLEL_COPY_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef __unix__
+#include <unistd.h>
+#endif
+
+#include "copy_on_write_ptr.hpp"
+
+// Lazy copies of very large contiguous payloads are bound by memory bandwidth, which one core
+// cannot saturate on its own. The facilities below split such copies across a pool of workers, let
+// threads which wait for the copy help with it, and bypass the cache with non-temporal stores
+// when the copy would not fit in it anyway.
+namespace cow_parallel_copy {
+
+   // The copy pool splits large memory copies into chunks, which are processed by its worker
+   // threads, by the thread which requested the copy, and by any thread which calls help().
+   class copy_pool {
+      public:
+
+         // Start a pool with the requested amount of worker threads. By default, there is one
+         // worker per hardware thread, minus the one which requests the copy.
+         explicit copy_pool(const unsigned worker_amount = default_worker_amount()) :
+            m_parallel_threshold{4 * 1024 * 1024},
+            m_streaming_threshold{last_level_cache_size()},
+            m_job_amount{0},
+            m_stopping{false}
+         {
+            start_workers(worker_amount);
+         }
+
+
+         // Destroying the pool waits for its workers to finish their current chunk
+         ~copy_pool() {
+            stop_workers();
+         }
+
+
+         // Pools own threads, so they may neither be copied nor moved
+         copy_pool(const copy_pool &) = delete;
+         copy_pool & operator=(const copy_pool &) = delete;
+
+
+         // Process-wide pool used by large_array. Like other process-wide facilities of this
+         // library, it is deliberately never destroyed.
+         static copy_pool & global() {
+            static copy_pool * const instance = new copy_pool{};
+            return *instance;
+         }
+
+
+         // Copies smaller than the parallel threshold are done by the calling thread alone, and
+         // copies larger than the streaming threshold (by default, the last-level cache size) use
+         // non-temporal stores. These thresholds should not be changed while copies are running.
+         void set_parallel_threshold(const std::size_t bytes) { m_parallel_threshold = bytes; }
+         void set_streaming_threshold(const std::size_t bytes) { m_streaming_threshold = bytes; }
+
+
+         // Replace the pool's workers with the requested amount of new ones, e.g. to measure how
+         // copies scale with core count. Like the thresholds, this must not be done during a copy.
+         void set_worker_amount(const unsigned worker_amount) {
+            stop_workers();
+            start_workers(worker_amount);
+         }
+
+         unsigned worker_amount() const { return static_cast<unsigned>(m_workers.size()); }
+
+
+         // Copy a block of memory, using the pool if it is large enough to be worth it
+         void copy(void * destination, const void * source, const std::size_t bytes) {
+            const bool streaming = (bytes >= m_streaming_threshold);
+            if(m_workers.empty() || (bytes < m_parallel_threshold)) {
+               copy_chunk(static_cast<char *>(destination), static_cast<const char *>(source), bytes, streaming);
+               return;
+            }
+
+            // Publish the copy job to workers and helpers
+            const std::size_t chunk_amount = (bytes + ChunkSize - 1) / ChunkSize;
+            std::shared_ptr<Job> job = std::make_shared<Job>(static_cast<char *>(destination),
+                                                             static_cast<const char *>(source),
+                                                             bytes,
+                                                             chunk_amount,
+                                                             streaming);
+            {
+               std::lock_guard<std::mutex> lock(m_mutex);
+               m_jobs.push_back(job);
+               m_job_amount.fetch_add(1, std::memory_order_release);
+            }
+            m_wake_condition.notify_all();
+
+            // Take part in the copy, then sleep until the other participants are done with theirs
+            run_chunks(job);
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done_condition.wait(lock, [&](){
+               return job->completed_chunks.load(std::memory_order_acquire) == chunk_amount;
+            });
+         }
+
+
+         // Process chunks of an ongoing copy, if there is one. Tell whether there was.
+         bool help() {
+            if(m_job_amount.load(std::memory_order_acquire) == 0) return false;
+
+            std::shared_ptr<Job> job;
+            {
+               std::lock_guard<std::mutex> lock(m_mutex);
+               if(m_jobs.empty()) return false;
+               job = m_jobs.front();
+            }
+            run_chunks(job);
+            return true;
+         }
+
+
+      private:
+
+         // Copies are split in chunks which are large enough to amortize scheduling overhead,
+         // and a multiple of the cache line size so that chunks do not share cache lines.
+         static const std::size_t ChunkSize = 1024 * 1024;
+
+         struct Job {
+            Job(char * dst, const char * src, std::size_t size, std::size_t chunks, bool stream) :
+               destination{dst},
+               source{src},
+               bytes{size},
+               chunk_amount{chunks},
+               streaming{stream},
+               next_chunk{0},
+               completed_chunks{0}
+            { }
+
+            char * const destination;
+            const char * const source;
+            const std::size_t bytes;
+            const std::size_t chunk_amount;
+            const bool streaming;
+            std::atomic<std::size_t> next_chunk;
+            std::atomic<std::size_t> completed_chunks;
+         };
+
+         std::size_t m_parallel_threshold;
+         std::size_t m_streaming_threshold;
+
+         std::mutex m_mutex;
+         std::condition_variable m_wake_condition;
+         std::condition_variable m_done_condition;
+         std::deque<std::shared_ptr<Job>> m_jobs;
+         std::atomic<std::size_t> m_job_amount;
+         bool m_stopping;
+         std::vector<std::thread> m_workers;
+
+         static unsigned default_worker_amount() {
+            const unsigned hardware_threads = std::thread::hardware_concurrency();
+            return (hardware_threads > 1) ? (hardware_threads - 1) : 0;
+         }
+
+         static std::size_t last_level_cache_size() {
+#if defined(__unix__) && defined(_SC_LEVEL3_CACHE_SIZE)
+            const long l3_size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+            if(l3_size > 0) return static_cast<std::size_t>(l3_size);
+#endif
+            return 32 * 1024 * 1024;
+         }
+
+         // Claim and copy chunks until there are none left. Whoever claims the last chunk withdraws
+         // the job, so that idle workers go back to sleep and helpers stop looking for chunks, and
+         // whoever completes the last chunk wakes up the thread which requested the copy.
+         void run_chunks(const std::shared_ptr<Job> & job) {
+            while(true) {
+               const std::size_t chunk = job->next_chunk.fetch_add(1, std::memory_order_relaxed);
+               if(chunk >= job->chunk_amount) return;
+               if(chunk == job->chunk_amount - 1) withdraw(job);
+
+               const std::size_t offset = chunk * ChunkSize;
+               copy_chunk(job->destination + offset,
+                          job->source + offset,
+                          std::min(job->bytes - offset, static_cast<std::size_t>(ChunkSize)),
+                          job->streaming);
+
+               if(job->completed_chunks.fetch_add(1, std::memory_order_acq_rel) + 1 == job->chunk_amount) {
+                  // Going through the mutex ensures that the requester either sees the completed
+                  // chunks when it checks for them, or is already waiting for our notification.
+                  { std::lock_guard<std::mutex> lock(m_mutex); }
+                  m_done_condition.notify_all();
+               }
+            }
+         }
+
+         void withdraw(const std::shared_ptr<Job> & job) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.erase(std::find(m_jobs.begin(), m_jobs.end(), job));
+            m_job_amount.fetch_sub(1, std::memory_order_relaxed);
+         }
+
+         // Copy a chunk of memory, possibly with non-temporal stores
+         static void copy_chunk(char * destination, const char * source, std::size_t bytes, const bool streaming) {
+#ifdef __SSE2__
+            if(streaming) {
+               // Stores must be aligned, so copy the misaligned head of the chunk normally
+               const std::size_t misalignment = reinterpret_cast<std::uintptr_t>(destination) % 16;
+               const std::size_t head = std::min(bytes, misalignment ? 16 - misalignment : 0);
+               std::memcpy(destination, source, head);
+               destination += head;
+               source += head;
+               bytes -= head;
+
+               const std::size_t vectors = bytes / 16;
+               __m128i * const vector_destination = reinterpret_cast<__m128i *>(destination);
+               const __m128i * const vector_source = reinterpret_cast<const __m128i *>(source);
+               for(std::size_t i = 0; i < vectors; ++i) {
+                  _mm_stream_si128(vector_destination + i, _mm_loadu_si128(vector_source + i));
+               }
+               std::memcpy(destination + vectors * 16, source + vectors * 16, bytes - vectors * 16);
+
+               // Non-temporal stores are weakly ordered, make sure they are visible to the waiter
+               _mm_sfence();
+               return;
+            }
+#endif
+            std::memcpy(destination, source, bytes);
+         }
+
+         void start_workers(const unsigned worker_amount) {
+            m_stopping = false;
+            for(unsigned i = 0; i < worker_amount; ++i) {
+               m_workers.emplace_back([this](){ worker_loop(); });
+            }
+         }
+
+         void stop_workers() {
+            {
+               std::lock_guard<std::mutex> lock(m_mutex);
+               m_stopping = true;
+            }
+            m_wake_condition.notify_all();
+            for(std::thread & worker : m_workers) worker.join();
+            m_workers.clear();
+         }
+
+         void worker_loop() {
+            while(true) {
+               std::shared_ptr<Job> job;
+               {
+                  std::unique_lock<std::mutex> lock(m_mutex);
+                  m_wake_condition.wait(lock, [this](){ return m_stopping || !m_jobs.empty(); });
+                  if(m_stopping) return;
+                  job = m_jobs.front();
+               }
+               run_chunks(job);
+            }
+         }
+   };
+
+
+   // Large contiguous array of trivially copyable elements, meant to be used as a copy-on-write
+   // payload. Copying it goes through the global copy pool, and threads waiting for a lazy copy of
+   // it help with that copy.
+   template <typename Element>
+   class large_array {
+      static_assert(std::is_trivially_copyable<Element>::value, "large_array elements are copied with memcpy");
+
+      public:
+
+         // Allocate an array, leaving its contents uninitialized
+         explicit large_array(const std::size_t size) :
+            m_size{size},
+            m_data{new Element[size]}
+         { }
+
+         // Allocate an array filled with copies of a value
+         large_array(const std::size_t size, const Element & value) :
+            large_array(size)
+         {
+            std::fill(begin(), end(), value);
+         }
+
+         large_array(const large_array & other) :
+            large_array(other.m_size)
+         {
+            copy_pool::global().copy(m_data.get(), other.m_data.get(), m_size * sizeof(Element));
+         }
+
+         large_array & operator=(const large_array & other) {
+            if(this == &other) return *this;
+            if(m_size != other.m_size) {
+               m_data.reset(new Element[other.m_size]);
+               m_size = other.m_size;
+            }
+            copy_pool::global().copy(m_data.get(), other.m_data.get(), m_size * sizeof(Element));
+            return *this;
+         }
+
+         large_array(large_array &&) = default;
+         large_array & operator=(large_array &&) = default;
+
+         std::size_t size() const { return m_size; }
+         Element * data() { return m_data.get(); }
+         const Element * data() const { return m_data.get(); }
+         Element & operator[](const std::size_t index) { return m_data[index]; }
+         const Element & operator[](const std::size_t index) const { return m_data[index]; }
+         Element * begin() { return m_data.get(); }
+         Element * end() { return m_data.get() + m_size; }
+         const Element * begin() const { return m_data.get(); }
+         const Element * end() const { return m_data.get() + m_size; }
+
+      private:
+         std::size_t m_size;
+         std::unique_ptr<Element[]> m_data;
+   };
+
+}
+
+// Threads waiting for a lazy copy of a large_array help with it
+template <typename Element>
+struct cow_copy_assistance<cow_parallel_copy::large_array<Element>> {
+   static const bool enabled = true;
+   static void help() { cow_parallel_copy::copy_pool::global().help(); }
+};
+
+#endif
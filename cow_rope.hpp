@@ -0,0 +1,388 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef COW_ROPE_H
+#define COW_ROPE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "copy_on_write_ptr.hpp"
+
+// The cow_rope class is a text buffer for large documents, which makes copies cheap like a
+// copy_on_write_ptr<std::string> does, but also keeps edits to shared copies cheap.
+//
+// Text is stored in the leaves of a height-balanced binary tree, as contiguous chunks of at most
+// MaxLeafSize characters so that reads remain cache-friendly. Every node is held by a
+// copy_on_write_ptr with the chosen ownership flag. Copying a rope thus shares all of its nodes,
+// and editing it only copies the nodes on the path to the edit which are still shared (none, if
+// the rope was not copied since). Structural edits, concatenations and slices create O(log n) new
+// nodes, and share the rest of the tree with the ropes which they come from.
+template <typename OwnershipFlag>
+class cow_rope {
+   public:
+      static const std::size_t MaxLeafSize = 1024;
+
+
+      // === BASIC CLASS LIFECYCLE ===
+
+      // Create an empty rope
+      cow_rope() : m_root{make_leaf(std::string{})} { }
+
+      // Create a rope from a string, split into full leaves
+      explicit cow_rope(const std::string & text) : m_root{build(text, 0, text.size())} { }
+
+      // Copying a rope shares all of its nodes, moving it transfers them
+      cow_rope(const cow_rope &) = default;
+      cow_rope(cow_rope &&) = default;
+      cow_rope & operator=(const cow_rope &) = default;
+      cow_rope & operator=(cow_rope &&) = default;
+      ~cow_rope() = default;
+
+
+      // === READ ACCESS ===
+
+      std::size_t size() const { return m_root.read().size; }
+      bool empty() const { return size() == 0; }
+
+      // Height of the tree, which is logarithmic in the amount of leaves
+      std::size_t height() const { return m_root.read().height; }
+
+      // Access a character in O(log n)
+      char at(const std::size_t pos) const {
+         check_position(pos, size() - 1, "cow_rope::at");
+         const Node * node = &m_root.read();
+         std::size_t offset = pos;
+         while(!node->is_leaf()) {
+            const std::size_t left_size = node->left_size;
+            if(offset < left_size) {
+               node = &node->left.read();
+            } else {
+               offset -= left_size;
+               node = &node->right.read();
+            }
+         }
+         return node->text[offset];
+      }
+
+      char operator[](const std::size_t pos) const { return at(pos); }
+
+      // Call a function on every leaf's text, in order. This is the fastest way to scan a rope.
+      template <typename Callable>
+      void for_each_chunk(Callable && callable) const {
+         for_each_chunk(m_root, callable);
+      }
+
+      // Copy part of the rope into a string
+      std::string substr(const std::size_t pos, std::size_t length = std::string::npos) const {
+         check_position(pos, size(), "cow_rope::substr");
+         length = std::min(length, size() - pos);
+         std::string result;
+         result.reserve(length);
+         append_range(m_root, pos, length, result);
+         return result;
+      }
+
+      std::string to_string() const { return substr(0); }
+
+
+      // === NON-DESTRUCTIVE STRUCTURAL OPERATIONS ===
+
+      // Split the rope in two at a given position. Both halves share nodes with this rope.
+      std::pair<cow_rope, cow_rope> split(const std::size_t pos) const {
+         check_position(pos, size(), "cow_rope::split");
+         std::pair<NodePtr, NodePtr> halves = split(m_root, pos);
+         return std::make_pair(cow_rope{std::move(halves.first)}, cow_rope{std::move(halves.second)});
+      }
+
+      // Extract part of the rope, sharing nodes with it
+      cow_rope slice(const std::size_t pos, std::size_t length = std::string::npos) const {
+         check_position(pos, size(), "cow_rope::slice");
+         length = std::min(length, size() - pos);
+         NodePtr tail = split(m_root, pos).second;
+         return cow_rope{split(tail, length).first};
+      }
+
+      // Concatenate ropes, sharing nodes with both of them
+      friend cow_rope operator+(const cow_rope & left, const cow_rope & right) {
+         return cow_rope{join(left.m_root, right.m_root)};
+      }
+
+
+      // === EDITING ===
+
+      // Overwrite a character, copying only the shared nodes on the path to it
+      void set(const std::size_t pos, const char character) {
+         check_position(pos, size() - 1, "cow_rope::set");
+         set(m_root, pos, character);
+      }
+
+      // Insert text. Short insertions into a leaf with enough room left are done in place, like
+      // set(), larger ones split the tree and join it back together around the new text.
+      void insert(const std::size_t pos, const std::string & text) {
+         check_position(pos, size(), "cow_rope::insert");
+         if(text.empty()) return;
+         if(leaf_room_at(pos) >= text.size()) {
+            insert_in_leaf(m_root, pos, text);
+         } else {
+            insert(pos, cow_rope{text});
+         }
+      }
+
+      void insert(const std::size_t pos, const cow_rope & rope) {
+         check_position(pos, size(), "cow_rope::insert");
+         std::pair<NodePtr, NodePtr> halves = split(m_root, pos);
+         m_root = join(join(halves.first, rope.m_root), halves.second);
+      }
+
+      // Erase text. Erasing part of a single leaf is done in place, other erasures split the
+      // tree and join the remaining parts back together.
+      void erase(const std::size_t pos, std::size_t length = std::string::npos) {
+         check_position(pos, size(), "cow_rope::erase");
+         length = std::min(length, size() - pos);
+         if(length == 0) return;
+         if(leaf_contains(pos, length)) {
+            erase_in_leaf(m_root, pos, length);
+         } else {
+            NodePtr tail = split(m_root, pos + length).second;
+            m_root = join(split(m_root, pos).first, tail);
+         }
+      }
+
+      void replace(const std::size_t pos, const std::size_t length, const std::string & text) {
+         erase(pos, length);
+         insert(pos, text);
+      }
+
+      void append(const std::string & text) { insert(size(), text); }
+      void append(const cow_rope & rope) { m_root = join(m_root, rope.m_root); }
+
+      cow_rope & operator+=(const cow_rope & rope) {
+         append(rope);
+         return *this;
+      }
+
+   private:
+
+      // Nodes are either leaves, which hold text, or branches, which have two non-empty children.
+      // Only the root of an empty rope may be an empty leaf.
+      struct Node;
+      using NodePtr = copy_on_write_ptr<Node, OwnershipFlag>;
+
+      struct Node {
+         std::string text;
+         NodePtr left;
+         NodePtr right;
+         std::size_t size;
+         std::size_t left_size;  // Cached to avoid touching both children when descending
+         std::size_t height;
+
+         bool is_leaf() const { return height == 0; }
+      };
+
+      NodePtr m_root;
+
+      explicit cow_rope(NodePtr root) : m_root{std::move(root)} { }
+
+      static void check_position(const std::size_t pos, const std::size_t max_pos, const char * function) {
+         if((pos > max_pos) || (max_pos == std::string::npos)) throw std::out_of_range(function);
+      }
+
+      static NodePtr make_leaf(std::string text) {
+         const std::size_t size = text.size();
+         return NodePtr{new Node{std::move(text), NodePtr{std::shared_ptr<Node>{}}, NodePtr{std::shared_ptr<Node>{}}, size, 0, 0}};
+      }
+
+      static NodePtr make_branch(NodePtr left, NodePtr right) {
+         const std::size_t left_size = left.read().size;
+         const std::size_t size = left_size + right.read().size;
+         const std::size_t height = std::max(left.read().height, right.read().height) + 1;
+         return NodePtr{new Node{std::string{}, std::move(left), std::move(right), size, left_size, height}};
+      }
+
+      // Build a perfectly balanced tree of full leaves from part of a string
+      static NodePtr build(const std::string & text, const std::size_t begin, const std::size_t end) {
+         const std::size_t length = end - begin;
+         if(length <= MaxLeafSize) return make_leaf(text.substr(begin, length));
+         const std::size_t leaf_amount = (length + MaxLeafSize - 1) / MaxLeafSize;
+         const std::size_t middle = begin + (leaf_amount / 2) * MaxLeafSize;
+         return make_branch(build(text, begin, middle), build(text, middle, end));
+      }
+
+      // Create a branch from two subtrees whose heights differ by at most two, rotating as in an
+      // AVL tree if needed so that the heights of its children differ by at most one.
+      static NodePtr balance(NodePtr left, NodePtr right) {
+         const std::size_t left_height = left.read().height;
+         const std::size_t right_height = right.read().height;
+         if(left_height > right_height + 1) {
+            const Node & l = left.read();
+            if(l.left.read().height >= l.right.read().height) {
+               return make_branch(l.left, make_branch(l.right, std::move(right)));
+            }
+            const Node & lr = l.right.read();
+            return make_branch(make_branch(l.left, lr.left), make_branch(lr.right, std::move(right)));
+         }
+         if(right_height > left_height + 1) {
+            const Node & r = right.read();
+            if(r.right.read().height >= r.left.read().height) {
+               return make_branch(make_branch(std::move(left), r.left), r.right);
+            }
+            const Node & rl = r.left.read();
+            return make_branch(make_branch(std::move(left), rl.left), make_branch(rl.right, r.right));
+         }
+         return make_branch(std::move(left), std::move(right));
+      }
+
+      // Concatenate two trees, descending along the spine of the taller one until heights match.
+      // Small adjacent leaves are merged, so that edits do not fragment the text too much.
+      static NodePtr join(const NodePtr & left, const NodePtr & right) {
+         const Node & l = left.read();
+         const Node & r = right.read();
+         if(l.size == 0) return right;
+         if(r.size == 0) return left;
+         if(l.is_leaf() && r.is_leaf() && (l.size + r.size <= MaxLeafSize)) return make_leaf(l.text + r.text);
+         if(l.height > r.height + 1) return balance(l.left, join(l.right, right));
+         if(r.height > l.height + 1) return balance(join(left, r.left), r.right);
+         return make_branch(left, right);
+      }
+
+      // Split a tree in two at a given position
+      static std::pair<NodePtr, NodePtr> split(const NodePtr & tree, const std::size_t pos) {
+         const Node & node = tree.read();
+         if(pos == 0) return std::make_pair(make_leaf(std::string{}), tree);
+         if(pos == node.size) return std::make_pair(tree, make_leaf(std::string{}));
+         if(node.is_leaf()) return std::make_pair(make_leaf(node.text.substr(0, pos)), make_leaf(node.text.substr(pos)));
+
+         const std::size_t left_size = node.left_size;
+         if(pos <= left_size) {
+            std::pair<NodePtr, NodePtr> halves = split(node.left, pos);
+            return std::make_pair(std::move(halves.first), join(halves.second, node.right));
+         }
+         std::pair<NodePtr, NodePtr> halves = split(node.right, pos - left_size);
+         return std::make_pair(join(node.left, halves.first), std::move(halves.second));
+      }
+
+      template <typename Callable>
+      static void for_each_chunk(const NodePtr & tree, Callable & callable) {
+         const Node & node = tree.read();
+         if(node.is_leaf()) {
+            callable(static_cast<const std::string &>(node.text));
+            return;
+         }
+         for_each_chunk(node.left, callable);
+         for_each_chunk(node.right, callable);
+      }
+
+      static void append_range(const NodePtr & tree, const std::size_t pos, const std::size_t length, std::string & output) {
+         if(length == 0) return;
+         const Node & node = tree.read();
+         if(node.is_leaf()) {
+            output.append(node.text, pos, length);
+            return;
+         }
+         const std::size_t left_size = node.left_size;
+         if(pos < left_size) append_range(node.left, pos, std::min(length, left_size - pos), output);
+         if(pos + length > left_size) {
+            const std::size_t right_pos = (pos > left_size) ? (pos - left_size) : 0;
+            append_range(node.right, right_pos, pos + length - left_size - right_pos, output);
+         }
+      }
+
+      // In-place edits descend through modify(), which copies the nodes which are still shared
+      static void set(NodePtr & tree, const std::size_t pos, const char character) {
+         tree.modify([&](Node & node){
+            if(node.is_leaf()) {
+               node.text[pos] = character;
+               return;
+            }
+            const std::size_t left_size = node.left_size;
+            if(pos < left_size) {
+               set(node.left, pos, character);
+            } else {
+               set(node.right, pos - left_size, character);
+            }
+         });
+      }
+
+      // Room left in the leaf where text would be inserted at a given position. Insertions at
+      // a leaf boundary go to the end of the leftmost leaf.
+      std::size_t leaf_room_at(std::size_t pos) const {
+         const Node * node = &m_root.read();
+         while(!node->is_leaf()) {
+            const std::size_t left_size = node->left_size;
+            if(pos <= left_size) {
+               node = &node->left.read();
+            } else {
+               pos -= left_size;
+               node = &node->right.read();
+            }
+         }
+         return (node->size < MaxLeafSize) ? (MaxLeafSize - node->size) : 0;
+      }
+
+      static void insert_in_leaf(NodePtr & tree, const std::size_t pos, const std::string & text) {
+         tree.modify([&](Node & node){
+            node.size += text.size();
+            if(node.is_leaf()) {
+               node.text.insert(pos, text);
+               return;
+            }
+            const std::size_t left_size = node.left_size;
+            if(pos <= left_size) {
+               node.left_size += text.size();
+               insert_in_leaf(node.left, pos, text);
+            } else {
+               insert_in_leaf(node.right, pos - left_size, text);
+            }
+         });
+      }
+
+      // Tell whether a range lies within a single leaf, which keeps some text once it's erased
+      bool leaf_contains(std::size_t pos, const std::size_t length) const {
+         const Node * node = &m_root.read();
+         while(!node->is_leaf()) {
+            const std::size_t left_size = node->left_size;
+            if(pos < left_size) {
+               node = &node->left.read();
+            } else {
+               pos -= left_size;
+               node = &node->right.read();
+            }
+         }
+         return (pos + length <= node->size) && (length < node->size);
+      }
+
+      static void erase_in_leaf(NodePtr & tree, const std::size_t pos, const std::size_t length) {
+         tree.modify([&](Node & node){
+            node.size -= length;
+            if(node.is_leaf()) {
+               node.text.erase(pos, length);
+               return;
+            }
+            const std::size_t left_size = node.left_size;
+            if(pos < left_size) {
+               node.left_size -= length;
+               erase_in_leaf(node.left, pos, length);
+            } else {
+               erase_in_leaf(node.right, pos - left_size, length);
+            }
+         });
+      }
+};
+
+#endif
@@ -0,0 +1,508 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef COW_SHARED_MEMORY_H
+#define COW_SHARED_MEMORY_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cow_ownership_flags/process_shared_atomics_flag.hpp"
+
+// Several processes on the same host may share copy-on-write payloads through a segment of shared
+// memory, created with shm_open (named segments) or memfd_create (anonymous segments, whose file
+// descriptor is handed over to child processes).
+//
+// A segment is split in a control region, which holds a table of payload descriptors with
+// process-shared use counts and construction flags, and a data region, which holds the payloads.
+// Every process maps the data region read-only, so payloads are constructed once through a
+// temporary writable mapping, then accessed through std::shared_ptrs which can be handed over to
+// copy_on_write_ptr's shared_ptr constructor. As such pointers do not own their payload, writing to
+// them makes a private copy in the process' own memory, and the segment is never modified.
+//
+// Since each process may map the segment at a different address, payloads must not contain
+// absolute pointers. Use offset_ptr, or containers built on it such as relocatable_array, instead.
+namespace cow_shared_memory {
+
+   // Relocatable pointer, which stores the distance from itself to its target rather than the
+   // target's address. It remains valid when the memory block holding both the pointer and its
+   // target is mapped at another address.
+   template <typename T>
+   class offset_ptr {
+      public:
+         offset_ptr(T * ptr = nullptr) { set(ptr); }
+         offset_ptr(const offset_ptr & other) { set(other.get()); }
+
+         offset_ptr & operator=(const offset_ptr & other) {
+            set(other.get());
+            return *this;
+         }
+
+         offset_ptr & operator=(T * ptr) {
+            set(ptr);
+            return *this;
+         }
+
+         T * get() const {
+            if(m_offset == Null) return nullptr;
+            return reinterpret_cast<T *>(reinterpret_cast<std::uintptr_t>(this) + m_offset);
+         }
+
+         T & operator*() const { return *get(); }
+         T * operator->() const { return get(); }
+         explicit operator bool() const { return m_offset != Null; }
+
+      private:
+         // An offset of 1 would point into the offset_ptr itself, so it cannot designate a target
+         static const std::intptr_t Null = 1;
+         std::intptr_t m_offset;
+
+         void set(T * ptr) {
+            if(ptr == nullptr) {
+               m_offset = Null;
+            } else {
+               m_offset = static_cast<std::intptr_t>(reinterpret_cast<std::uintptr_t>(ptr) -
+                                                     reinterpret_cast<std::uintptr_t>(this));
+            }
+         }
+   };
+
+
+   // The layout of the control region is shared by all processes which map a segment
+   namespace detail {
+
+      const std::uint32_t SegmentMagic = 0x436f5753;  // "CoWS"
+      const std::size_t MaxNameLength = 63;
+      const std::uint64_t ConstructionFailed = ~std::uint64_t{0};
+
+      struct SegmentHeader {
+         std::atomic<std::uint32_t> magic;         // Set once the control region is initialized
+         std::atomic<std::uint32_t> table_lock;    // Protects the descriptor table
+         std::uint64_t max_payloads;
+         std::uint64_t control_bytes;
+         std::uint64_t data_bytes;
+         std::atomic<std::uint64_t> data_used;
+      };
+
+      struct PayloadDescriptor {
+         char name[MaxNameLength + 1];              // Empty if the descriptor is free
+         std::uint64_t offset;                      // Location of the payload in the data region
+         std::atomic<std::uint64_t> use_count;      // Payload handles across all processes
+         cow_ownership_flags::process_shared_atomics_flag constructed;
+      };
+
+      [[noreturn]] inline void throw_system_error(const char * operation) {
+         throw std::system_error(errno, std::generic_category(), operation);
+      }
+
+      inline std::size_t round_up(const std::size_t size, const std::size_t alignment) {
+         return (size + alignment - 1) / alignment * alignment;
+      }
+
+      // Process-local mapping of a segment. It is kept alive by every payload handle.
+      struct Mapping {
+         int fd;
+         SegmentHeader * header;
+         std::size_t control_bytes;
+         const char * data;
+         std::size_t data_bytes;
+
+         explicit Mapping(const int segment_fd) :
+            fd{segment_fd},
+            header{nullptr},
+            control_bytes{0},
+            data{nullptr},
+            data_bytes{0}
+         { }
+
+         ~Mapping() {
+            if(data != nullptr) munmap(const_cast<char *>(data), data_bytes);
+            if(header != nullptr) munmap(header, control_bytes);
+            close(fd);
+         }
+
+         Mapping(const Mapping &) = delete;
+         Mapping & operator=(const Mapping &) = delete;
+
+         PayloadDescriptor * descriptors() const {
+            return reinterpret_cast<PayloadDescriptor *>(reinterpret_cast<char *>(header) + descriptor_offset());
+         }
+
+         static std::size_t descriptor_offset() {
+            return round_up(sizeof(SegmentHeader), alignof(PayloadDescriptor));
+         }
+      };
+
+      // Releasing a payload handle decrements the process-shared use count
+      struct PayloadRelease {
+         std::shared_ptr<Mapping> mapping;
+         PayloadDescriptor * descriptor;
+
+         void operator()(const void *) const {
+            descriptor->use_count.fetch_sub(1, std::memory_order_release);
+         }
+      };
+
+   }
+
+
+   // Payloads are constructed through a bump allocator over the data region, which is handed
+   // over to the initialization routine of find_or_construct(). Memory is never freed.
+   class segment_allocator {
+      public:
+         segment_allocator(char * writable_data, detail::SegmentHeader & header) :
+            m_data{writable_data},
+            m_header(header)
+         { }
+
+         // Allocate a block of memory in the data region, or throw std::bad_alloc if it's full
+         void * allocate(const std::size_t bytes, const std::size_t alignment) {
+            std::uint64_t used = m_header.data_used.load(std::memory_order_relaxed);
+            std::uint64_t start;
+            do {
+               start = detail::round_up(used, alignment);
+               if(start + bytes > m_header.data_bytes) throw std::bad_alloc{};
+            } while(!m_header.data_used.compare_exchange_weak(used, start + bytes, std::memory_order_relaxed));
+            return m_data + start;
+         }
+
+         template <typename T>
+         T * allocate_array(const std::size_t size) {
+            return static_cast<T *>(allocate(size * sizeof(T), alignof(T)));
+         }
+
+         template <typename T, typename... Args>
+         T * construct(Args &&... args) {
+            return new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+         }
+
+      private:
+         char * m_data;
+         detail::SegmentHeader & m_header;
+   };
+
+
+   // Array of trivially copyable elements which may live in a shared memory segment. Copies of it
+   // are allocated on the heap, so that a copy_on_write_ptr to an array from a segment makes a
+   // private, writable copy in the process' own memory upon writing.
+   template <typename Element>
+   class relocatable_array {
+      static_assert(std::is_trivially_copyable<Element>::value, "relocatable_array elements are copied with memcpy");
+
+      public:
+
+         // Allocate an array in a shared memory segment, leaving its contents uninitialized
+         relocatable_array(segment_allocator & allocator, const std::size_t size) :
+            m_size{size},
+            m_data{allocator.allocate_array<Element>(size)},
+            m_heap_allocated{false}
+         { }
+
+         // Allocate an array on the heap, filled with copies of a value
+         relocatable_array(const std::size_t size, const Element & value) :
+            m_size{size},
+            m_data{new Element[size]},
+            m_heap_allocated{true}
+         {
+            std::fill(begin(), end(), value);
+         }
+
+         relocatable_array(const relocatable_array & other) :
+            m_size{other.m_size},
+            m_data{new Element[other.m_size]},
+            m_heap_allocated{true}
+         {
+            std::memcpy(m_data.get(), other.m_data.get(), m_size * sizeof(Element));
+         }
+
+         // Assignment targets are always private copies, as segments are mapped read-only
+         relocatable_array & operator=(const relocatable_array & other) {
+            if(this == &other) return *this;
+            if(!m_heap_allocated || (m_size != other.m_size)) {
+               Element * const data = new Element[other.m_size];
+               release();
+               m_data = data;
+               m_size = other.m_size;
+               m_heap_allocated = true;
+            }
+            std::memcpy(m_data.get(), other.m_data.get(), m_size * sizeof(Element));
+            return *this;
+         }
+
+         // Arrays which live in a segment are never destroyed, as the segment may outlive us
+         ~relocatable_array() { release(); }
+
+         std::size_t size() const { return m_size; }
+         Element * data() { return m_data.get(); }
+         const Element * data() const { return m_data.get(); }
+         Element & operator[](const std::size_t index) { return m_data.get()[index]; }
+         const Element & operator[](const std::size_t index) const { return m_data.get()[index]; }
+         Element * begin() { return m_data.get(); }
+         Element * end() { return m_data.get() + m_size; }
+         const Element * begin() const { return m_data.get(); }
+         const Element * end() const { return m_data.get() + m_size; }
+
+      private:
+         std::size_t m_size;
+         offset_ptr<Element> m_data;
+         bool m_heap_allocated;
+
+         void release() {
+            if(m_heap_allocated) delete[] m_data.get();
+         }
+   };
+
+
+   // Process-local handle to a shared memory segment. Handles are cheap to copy, and the segment
+   // remains mapped as long as a handle or a payload from it is alive in the process.
+   class shared_segment {
+      public:
+
+         // Create a named segment (see shm_open) with the requested data capacity and payload
+         // amount. Creation fails if a segment with the same name already exists.
+         static shared_segment create(const std::string & name,
+                                      const std::size_t data_bytes,
+                                      const std::size_t max_payloads = 64) {
+            const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            if(fd < 0) detail::throw_system_error("shm_open");
+            return initialize(fd, data_bytes, max_payloads);
+         }
+
+         // Open a named segment, which may still be being created by another process
+         static shared_segment open(const std::string & name) {
+            const int fd = shm_open(name.c_str(), O_RDWR, 0);
+            if(fd < 0) detail::throw_system_error("shm_open");
+            return shared_segment{fd};
+         }
+
+         // Remove the name of a segment. Processes which have it mapped keep using it.
+         static void remove(const std::string & name) {
+            if(shm_unlink(name.c_str()) != 0) detail::throw_system_error("shm_unlink");
+         }
+
+#ifdef MFD_CLOEXEC
+         // Create an anonymous segment, which other processes access through its file descriptor
+         // (inherited across fork() and exec(), or sent over a UNIX socket).
+         static shared_segment create_anonymous(const std::size_t data_bytes, const std::size_t max_payloads = 64) {
+            const int fd = memfd_create("cow_shared_memory", 0);
+            if(fd < 0) detail::throw_system_error("memfd_create");
+            return initialize(fd, data_bytes, max_payloads);
+         }
+#endif
+
+         // Open a segment from a file descriptor, which is duplicated
+         static shared_segment from_fd(const int fd) {
+            const int own_fd = dup(fd);
+            if(own_fd < 0) detail::throw_system_error("dup");
+            return shared_segment{own_fd};
+         }
+
+         int fd() const { return m_mapping->fd; }
+         std::size_t data_capacity() const { return m_mapping->data_bytes; }
+         std::size_t data_used() const { return m_mapping->header->data_used.load(std::memory_order_relaxed); }
+
+
+         // Get a handle to the payload of a given name. If there is no such payload yet, construct
+         // it by calling initializer, which receives a segment_allocator and returns a pointer to
+         // the payload. Only one process runs the initializer, the others wait for it. If that
+         // initializer throws, its exception is propagated, and the payload cannot be used.
+         template <typename T, typename Initializer>
+         std::shared_ptr<T> find_or_construct(const std::string & name, Initializer && initializer) {
+            detail::PayloadDescriptor & descriptor = find_or_claim_descriptor(name);
+            descriptor.use_count.fetch_add(1, std::memory_order_relaxed);
+            const std::shared_ptr<T> handle(nullptr, detail::PayloadRelease{m_mapping, &descriptor});
+
+            std::exception_ptr failure;
+            descriptor.constructed.acquire_ownership_once([&](){
+               try {
+                  descriptor.offset = construct<T>(initializer);
+               } catch(...) {
+                  descriptor.offset = detail::ConstructionFailed;
+                  failure = std::current_exception();
+               }
+            });
+            if(failure) std::rethrow_exception(failure);
+            if(descriptor.offset == detail::ConstructionFailed) {
+               throw std::runtime_error("Construction of shared payload " + name + " failed in another process");
+            }
+
+            // Alias the handle, which releases the use count, to the read-only payload
+            T * const payload = reinterpret_cast<T *>(const_cast<char *>(m_mapping->data) + descriptor.offset);
+            return std::shared_ptr<T>(handle, payload);
+         }
+
+
+         // Amount of handles to a payload across all processes, or zero if there is no such payload
+         std::size_t use_count(const std::string & name) const {
+            TableLock lock{*m_mapping->header};
+            const detail::PayloadDescriptor * const descriptor = find_descriptor(name);
+            return (descriptor == nullptr) ? 0 : descriptor->use_count.load(std::memory_order_acquire);
+         }
+
+
+      private:
+
+         std::shared_ptr<detail::Mapping> m_mapping;
+
+         // The descriptor table is rarely accessed, so a spinlock is good enough to protect it
+         class TableLock {
+            public:
+               explicit TableLock(detail::SegmentHeader & header) : m_header(header) {
+                  while(m_header.table_lock.exchange(1, std::memory_order_acquire) != 0) std::this_thread::yield();
+               }
+               ~TableLock() { m_header.table_lock.store(0, std::memory_order_release); }
+               TableLock(const TableLock &) = delete;
+               TableLock & operator=(const TableLock &) = delete;
+            private:
+               detail::SegmentHeader & m_header;
+         };
+
+         // Map an existing segment, waiting for its creator to initialize it if need be
+         explicit shared_segment(const int fd) :
+            m_mapping{std::make_shared<detail::Mapping>(fd)}
+         {
+            const std::size_t page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+            struct stat status;
+            do {
+               if(fstat(fd, &status) != 0) detail::throw_system_error("fstat");
+               if(static_cast<std::size_t>(status.st_size) < page_size) std::this_thread::yield();
+            } while(static_cast<std::size_t>(status.st_size) < page_size);
+
+            // Map the first page to get the size of the control region
+            void * const first_page = mmap(nullptr, page_size, PROT_READ, MAP_SHARED, fd, 0);
+            if(first_page == MAP_FAILED) detail::throw_system_error("mmap");
+            const detail::SegmentHeader & preview = *static_cast<detail::SegmentHeader *>(first_page);
+            while(preview.magic.load(std::memory_order_acquire) != detail::SegmentMagic) std::this_thread::yield();
+            const std::size_t control_bytes = preview.control_bytes;
+            const std::size_t data_bytes = preview.data_bytes;
+            munmap(first_page, page_size);
+
+            // Map the control region read-write and the data region read-only
+            void * const control = mmap(nullptr, control_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if(control == MAP_FAILED) detail::throw_system_error("mmap");
+            m_mapping->header = static_cast<detail::SegmentHeader *>(control);
+            m_mapping->control_bytes = control_bytes;
+            void * const data = mmap(nullptr, data_bytes, PROT_READ, MAP_SHARED, fd, control_bytes);
+            if(data == MAP_FAILED) detail::throw_system_error("mmap");
+            m_mapping->data = static_cast<const char *>(data);
+            m_mapping->data_bytes = data_bytes;
+         }
+
+         // Size a new segment and initialize its control region, then map it like other processes
+         static shared_segment initialize(const int fd, const std::size_t data_bytes, const std::size_t max_payloads) {
+            const std::size_t page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+            const std::size_t control_bytes =
+               detail::round_up(detail::Mapping::descriptor_offset() + max_payloads * sizeof(detail::PayloadDescriptor), page_size);
+            const std::size_t rounded_data_bytes = detail::round_up(data_bytes, page_size);
+            if(ftruncate(fd, static_cast<off_t>(control_bytes + rounded_data_bytes)) != 0) {
+               const int error = errno;
+               close(fd);
+               throw std::system_error(error, std::generic_category(), "ftruncate");
+            }
+
+            void * const control = mmap(nullptr, control_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if(control == MAP_FAILED) {
+               const int error = errno;
+               close(fd);
+               throw std::system_error(error, std::generic_category(), "mmap");
+            }
+            detail::SegmentHeader * const header = new(control) detail::SegmentHeader{};
+            header->table_lock.store(0, std::memory_order_relaxed);
+            header->max_payloads = max_payloads;
+            header->control_bytes = control_bytes;
+            header->data_bytes = rounded_data_bytes;
+            header->data_used.store(0, std::memory_order_relaxed);
+            detail::PayloadDescriptor * const descriptors = reinterpret_cast<detail::PayloadDescriptor *>(
+               static_cast<char *>(control) + detail::Mapping::descriptor_offset()
+            );
+            for(std::size_t i = 0; i < max_payloads; ++i) {
+               detail::PayloadDescriptor * const descriptor = new(&descriptors[i]) detail::PayloadDescriptor{{}, 0, {}, false};
+               descriptor->use_count.store(0, std::memory_order_relaxed);
+            }
+            header->magic.store(detail::SegmentMagic, std::memory_order_release);
+            munmap(control, control_bytes);
+
+            return shared_segment{fd};
+         }
+
+         const detail::PayloadDescriptor * find_descriptor(const std::string & name) const {
+            const detail::PayloadDescriptor * const descriptors = m_mapping->descriptors();
+            for(std::size_t i = 0; i < m_mapping->header->max_payloads; ++i) {
+               if(name == descriptors[i].name) return &descriptors[i];
+            }
+            return nullptr;
+         }
+
+         detail::PayloadDescriptor & find_or_claim_descriptor(const std::string & name) {
+            if(name.empty() || (name.size() > detail::MaxNameLength)) {
+               throw std::invalid_argument("Shared payload names must have between 1 and 63 characters");
+            }
+
+            TableLock lock{*m_mapping->header};
+            const detail::PayloadDescriptor * const existing = find_descriptor(name);
+            if(existing != nullptr) return const_cast<detail::PayloadDescriptor &>(*existing);
+
+            detail::PayloadDescriptor * const descriptors = m_mapping->descriptors();
+            for(std::size_t i = 0; i < m_mapping->header->max_payloads; ++i) {
+               if(descriptors[i].name[0] == '\0') {
+                  std::strncpy(descriptors[i].name, name.c_str(), detail::MaxNameLength);
+                  return descriptors[i];
+               }
+            }
+            throw std::length_error("The shared memory segment's payload table is full");
+         }
+
+         // Construct a payload through a temporary writable mapping of the data region, and tell
+         // where it ended up. Payloads only contain relative pointers, so they stay valid when
+         // accessed through the read-only mapping.
+         template <typename T, typename Initializer>
+         std::uint64_t construct(Initializer & initializer) {
+            const std::size_t data_bytes = m_mapping->data_bytes;
+            void * const writable = mmap(nullptr, data_bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                         m_mapping->fd, static_cast<off_t>(m_mapping->control_bytes));
+            if(writable == MAP_FAILED) detail::throw_system_error("mmap");
+            struct Unmapper {
+               void * address;
+               std::size_t bytes;
+               ~Unmapper() { munmap(address, bytes); }
+            } unmapper{writable, data_bytes};
+
+            segment_allocator allocator{static_cast<char *>(writable), *m_mapping->header};
+            const T * const payload = initializer(allocator);
+            return static_cast<std::uint64_t>(reinterpret_cast<const char *>(payload) - static_cast<char *>(writable));
+         }
+   };
+
+}
+
+#endif
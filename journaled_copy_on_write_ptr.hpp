@@ -0,0 +1,326 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef JOURNALED_COW_PTR_H
+#define JOURNALED_COW_PTR_H
+
+#include <array>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "cow_ownership_flags/ownership_flag_traits.hpp"
+
+// Journaling requires knowing how to look up, overwrite and erase individual elements of a
+// payload, and roughly how much memory each element takes. This trait describes that for map-like
+// payloads, whose keys are arbitrary, and for array-like payloads, whose keys are the indices of
+// existing elements.
+template <typename T>
+struct cow_journal_traits;
+
+namespace cow_journal_detail {
+
+   template <typename Map>
+   struct map_traits {
+      using key_type = typename Map::key_type;
+      using mapped_type = typename Map::mapped_type;
+      static const bool erasable = true;
+      static const std::size_t element_footprint = sizeof(typename Map::value_type) + 4 * sizeof(void *);
+
+      static std::size_t size(const Map & payload) { return payload.size(); }
+
+      static const mapped_type * find(const Map & payload, const key_type & key) {
+         const auto it = payload.find(key);
+         return (it == payload.end()) ? nullptr : &it->second;
+      }
+
+      // Any key may be inserted into a map
+      static void check_key(const Map &, const key_type &) { }
+
+      // Overwrite an element, or erase it if no value is provided
+      static void apply(Map & payload, const key_type & key, const mapped_type * value) {
+         if(value == nullptr) {
+            payload.erase(key);
+            return;
+         }
+         const auto insertion = payload.insert(std::make_pair(key, *value));
+         if(!insertion.second) insertion.first->second = *value;
+      }
+   };
+
+   template <typename Sequence>
+   struct sequence_traits {
+      using key_type = std::size_t;
+      using mapped_type = typename Sequence::value_type;
+      static const bool erasable = false;
+      static const std::size_t element_footprint = sizeof(mapped_type);
+
+      static std::size_t size(const Sequence & payload) { return payload.size(); }
+
+      static const mapped_type * find(const Sequence & payload, const key_type & index) {
+         return (index < payload.size()) ? &payload[index] : nullptr;
+      }
+
+      // Elements may only be overwritten, not appended
+      static void check_key(const Sequence & payload, const key_type & index) {
+         if(index >= payload.size()) throw std::out_of_range("Journaled writes cannot resize sequences");
+      }
+
+      static void apply(Sequence & payload, const key_type & index, const mapped_type * value) {
+         payload[index] = *value;
+      }
+   };
+
+}
+
+template <typename Key, typename Value, typename Compare, typename Allocator>
+struct cow_journal_traits<std::map<Key, Value, Compare, Allocator>> :
+   cow_journal_detail::map_traits<std::map<Key, Value, Compare, Allocator>>
+{
+   template <typename Entry> using journal_type = std::map<Key, Entry, Compare>;
+};
+
+template <typename Key, typename Value, typename Hash, typename KeyEqual, typename Allocator>
+struct cow_journal_traits<std::unordered_map<Key, Value, Hash, KeyEqual, Allocator>> :
+   cow_journal_detail::map_traits<std::unordered_map<Key, Value, Hash, KeyEqual, Allocator>>
+{
+   template <typename Entry> using journal_type = std::unordered_map<Key, Entry, Hash, KeyEqual>;
+};
+
+template <typename Element, typename Allocator>
+struct cow_journal_traits<std::vector<Element, Allocator>> :
+   cow_journal_detail::sequence_traits<std::vector<Element, Allocator>>
+{
+   template <typename Entry> using journal_type = std::map<std::size_t, Entry>;
+};
+
+template <typename Element, std::size_t Size>
+struct cow_journal_traits<std::array<Element, Size>> :
+   cow_journal_detail::sequence_traits<std::array<Element, Size>>
+{
+   template <typename Entry> using journal_type = std::map<std::size_t, Entry>;
+};
+
+// The journaled_copy_on_write_ptr class is a variant of copy_on_write_ptr for large map-like or
+// array-like payloads which receive a few small writes between long read-only phases.
+//
+// Rather than copying the whole payload on the first write, a pointer which does not own its
+// payload records its element writes in a private journal laid over the shared payload. Lookups
+// consult the journal first, and the private copy is only materialized once the journal's memory
+// footprint grows past a configurable fraction of the payload's, or when compact() or read() is
+// called. Journal entries are tree or hash nodes, which makes them much larger than array elements.
+//
+// Acquiring ownership thus means getting a private journal, which is a cheap lazy copy. Copying a
+// pointer shares both its payload and its journal, so that the journal is copied on the next write.
+template <typename T,
+          typename OwnershipFlag>
+class journaled_copy_on_write_ptr {
+   static_assert(cow_ownership_flags::check_ownership_flag<OwnershipFlag, true>::value,
+                 "Invalid ownership flag");
+
+   public:
+      using traits = cow_journal_traits<T>;
+      using key_type = typename traits::key_type;
+      using mapped_type = typename traits::mapped_type;
+
+
+      // === BASIC CLASS LIFECYCLE ===
+
+      // Construct from a raw pointer, acquire ownership. By default, the journal may grow up to
+      // 1/64 of the payload's memory footprint before the private copy is materialized.
+      journaled_copy_on_write_ptr(T * ptr, const double max_journal_ratio = 1.0 / 64) :
+         m_payload{ptr},
+         m_journal{},
+         m_max_journal_ratio{max_journal_ratio},
+         m_ownership{true}
+      { }
+
+      // Move-construct from a journaled_copy_on_write_ptr, take over its ownership status.
+      journaled_copy_on_write_ptr(journaled_copy_on_write_ptr && cptr) :
+         m_payload{std::move(cptr.m_payload)},
+         m_journal{std::move(cptr.m_journal)},
+         m_max_journal_ratio{cptr.m_max_journal_ratio},
+         m_ownership{std::move(cptr.m_ownership)}
+      { }
+
+      // Copy-construct from a journaled_copy_on_write_ptr, DO NOT acquire ownership, and make the
+      // source give up ownership too as its payload and journal are now shared.
+      journaled_copy_on_write_ptr(const journaled_copy_on_write_ptr & cptr) :
+         m_payload{cptr.m_payload},
+         m_journal{cptr.m_journal},
+         m_max_journal_ratio{cptr.m_max_journal_ratio},
+         m_ownership{false}
+      {
+         cptr.m_ownership.set_ownership(false);
+      }
+
+      // All our data members can take care of themselves on their own.
+      ~journaled_copy_on_write_ptr() = default;
+
+      // Moving a journaled_copy_on_write_ptr transfers ownership of the underlying data
+      journaled_copy_on_write_ptr & operator=(journaled_copy_on_write_ptr && cptr) = default;
+
+      // Copying a journaled_copy_on_write_ptr DOES NOT transfer ownership of the underlying content
+      journaled_copy_on_write_ptr & operator=(const journaled_copy_on_write_ptr & cptr) {
+         cptr.m_ownership.set_ownership(false);
+         m_ownership.set_ownership(false);
+         m_payload = cptr.m_payload;
+         m_journal = cptr.m_journal;
+         m_max_journal_ratio = cptr.m_max_journal_ratio;
+         return *this;
+      }
+
+
+      // === ELEMENT ACCESS ===
+
+      // Look up an element, taking journaled writes into account. Returns nullptr if there is no
+      // such element. CAUTION: Like other references to CoW data, writes may invalidate the result.
+      const mapped_type * find(const key_type & key) const {
+         if(m_journal) {
+            const auto entry = m_journal->find(key);
+            if(entry != m_journal->end()) return entry->second.erased ? nullptr : &entry->second.value;
+         }
+         return traits::find(*m_payload, key);
+      }
+
+      bool contains(const key_type & key) const { return find(key) != nullptr; }
+
+      // Overwrite or insert an element. This requires ownership, which is acquired as needed by
+      // starting a private journal rather than copying the payload.
+      void set(const key_type & key, const mapped_type & value) {
+         traits::check_key(*m_payload, key);
+         update(key, &value);
+      }
+
+      // Erase an element of a map-like payload
+      void erase(const key_type & key) {
+         static_assert(traits::erasable, "Elements of this payload type cannot be erased");
+         update(key, nullptr);
+      }
+
+
+      // === WHOLE-PAYLOAD ACCESS ===
+
+      // Reading the payload as a whole requires applying the journal, if any, to a private copy
+      // first. Without a journal, the payload is read as is, even if it is shared. Applying the
+      // journal does not change the pointer's value, so this may be done on const pointers, but
+      // like writes, it must not race with other accesses to the same pointer.
+      // CAUTION: Be careful with references to non-const CoW data, as writes may invalidate them.
+      const T & read() const {
+         if(m_journal) compact();
+         return *m_payload;
+      }
+
+      // Replacing the payload as a whole discards the journal
+      void write(const T & value) { replace(value); }
+      void write(T && value) { replace(std::move(value)); }
+
+
+      // === JOURNAL MANAGEMENT ===
+
+      // Materialize the private copy of the payload and apply the journal to it now. If this
+      // pointer did not own its payload, this amounts to an eager copy.
+      void compact() const {
+         m_ownership.acquire_ownership_once([this](){ materialize(); });
+         if(m_journal) materialize();
+      }
+
+      // Amount of element writes which are waiting to be applied to a private copy
+      std::size_t journal_size() const { return m_journal ? m_journal->size() : 0; }
+
+      // Change the journal footprint, relative to the payload footprint, beyond which the private
+      // copy is materialized. A ratio of zero means that the payload is copied eagerly on first write.
+      void set_max_journal_ratio(const double max_journal_ratio) {
+         m_max_journal_ratio = max_journal_ratio;
+      }
+
+   private:
+
+      // Journal entries either hold a new value for an element, or tell that it was erased
+      struct JournalEntry {
+         bool erased;
+         mapped_type value;
+      };
+      using Journal = typename traits::template journal_type<JournalEntry>;
+
+      // Compacting the journal changes how the payload is stored, but not its value
+      mutable std::shared_ptr<T> m_payload;
+      mutable std::shared_ptr<Journal> m_journal;  // Absent when the payload is private or not written to
+      double m_max_journal_ratio;
+      mutable OwnershipFlag m_ownership;           // Copying a const pointer revokes its ownership
+
+      template <typename Value>
+      void replace(Value && value) {
+         bool replaced = false;
+         m_ownership.acquire_ownership_once([&](){
+            m_payload = std::make_shared<T>(std::forward<Value>(value));
+            m_journal.reset();
+            replaced = true;
+         });
+         if(replaced) return;
+         if(m_journal) {
+            m_payload = std::make_shared<T>(std::forward<Value>(value));
+            m_journal.reset();
+         } else {
+            *m_payload = std::forward<Value>(value);
+         }
+      }
+
+      // Apply an element write (or an erasure, if value is nullptr), journaling it if the payload
+      // is not private. Once the journal grows too large, it is applied to a private copy.
+      void update(const key_type & key, const mapped_type * value) {
+         m_ownership.acquire_ownership_once([this](){
+            if(journal_size() + 1 > max_journal_size()) {
+               materialize();
+            } else {
+               m_journal = m_journal ? std::make_shared<Journal>(*m_journal) : std::make_shared<Journal>();
+            }
+         });
+
+         if(!m_journal) {
+            traits::apply(*m_payload, key, value);
+            return;
+         }
+         JournalEntry & entry = (*m_journal)[key];
+         entry.erased = (value == nullptr);
+         if(value != nullptr) entry.value = *value;
+         if(m_journal->size() > max_journal_size()) materialize();
+      }
+
+      // Journal entries are estimated to take as much memory as a map node, links included
+      std::size_t max_journal_size() const {
+         const std::size_t entry_footprint = sizeof(typename Journal::value_type) + 4 * sizeof(void *);
+         const double payload_footprint = static_cast<double>(traits::size(*m_payload)) * traits::element_footprint;
+         return static_cast<std::size_t>(m_max_journal_ratio * payload_footprint / entry_footprint);
+      }
+
+      // Make a private copy of the payload with the journal applied to it, and drop the journal
+      void materialize() const {
+         std::shared_ptr<T> copy = std::make_shared<T>(*m_payload);
+         if(m_journal) {
+            for(const auto & entry : *m_journal) {
+               traits::apply(*copy, entry.first, entry.second.erased ? nullptr : &entry.second.value);
+            }
+         }
+         m_payload = std::move(copy);
+         m_journal.reset();
+      }
+};
+
+#endif
@@ -0,0 +1,331 @@
+/*  This file is part of copy_on_write_ptr.
+
+    copy_on_write_ptr is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    copy_on_write_ptr is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with copy_on_write_ptr.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef REPLICATED_COW_PTR_H
+#define REPLICATED_COW_PTR_H
+
+#include <sched.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "cow_ownership_flags/ownership_flag_traits.hpp"
+
+namespace cow_numa {
+
+   namespace detail {
+
+      // Parse a Linux CPU or node list, such as "0-3,8,10-11"
+      inline std::vector<unsigned> parse_list(const std::string & list) {
+         std::vector<unsigned> result;
+         std::istringstream stream{list};
+         std::string range;
+         while(std::getline(stream, range, ',')) {
+            if(range.find_first_of("0123456789") == std::string::npos) continue;
+            const auto dash = range.find('-');
+            const unsigned first = std::stoul(range.substr(0, dash));
+            const unsigned last = (dash == std::string::npos) ? first : std::stoul(range.substr(dash + 1));
+            for(unsigned item = first; item <= last; ++item) result.push_back(item);
+         }
+         return result;
+      }
+
+      // Read the first line of a file, tell whether that succeeded
+      inline bool read_line(const std::string & path, std::string & line) {
+         std::ifstream file{path};
+         return static_cast<bool>(std::getline(file, line));
+      }
+
+      // CPUs which the calling thread is allowed to run on
+      inline std::vector<unsigned> allowed_cpus() {
+         cpu_set_t cpu_set;
+         if(sched_getaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+            throw std::system_error(errno, std::generic_category(), "sched_getaffinity");
+         }
+         std::vector<unsigned> result;
+         for(unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if(CPU_ISSET(cpu, &cpu_set)) result.push_back(cpu);
+         }
+         return result;
+      }
+
+   }
+
+   // Description of which CPUs belong to which NUMA node. Nodes are numbered densely from 0, even
+   // if the operating system's node numbers have holes.
+   class topology {
+      public:
+
+         // Topology of the machine, as reported by Linux. Machines without NUMA support, or
+         // without a mounted sysfs, are described as a single node.
+         static std::shared_ptr<const topology> system() {
+            static const std::shared_ptr<const topology> * const instance =
+               new std::shared_ptr<const topology>{detect()};
+            return *instance;
+         }
+
+         // Simulated topology, which splits the CPUs that we may run on into contiguous groups.
+         // This allows exercising NUMA-aware code on a single-node machine, by pinning threads to
+         // the CPUs of each node. If there are more nodes than CPUs, some nodes have no CPUs.
+         static std::shared_ptr<const topology> simulated(const std::size_t node_count) {
+            if(node_count == 0) throw std::invalid_argument{"A NUMA topology needs at least one node"};
+            const auto cpus = detail::allowed_cpus();
+            std::vector<std::vector<unsigned>> node_cpus(node_count);
+            for(std::size_t i = 0; i < cpus.size(); ++i) {
+               node_cpus[i * node_count / cpus.size()].push_back(cpus[i]);
+            }
+            return std::shared_ptr<const topology>{new topology{std::move(node_cpus)}};
+         }
+
+         std::size_t node_count() const { return m_node_cpus.size(); }
+
+         const std::vector<unsigned> & cpus_of(const std::size_t node) const { return m_node_cpus.at(node); }
+
+         // CPUs which the topology does not know about are attributed to the first node
+         std::size_t node_of(const unsigned cpu) const {
+            return (cpu < m_cpu_nodes.size()) ? m_cpu_nodes[cpu] : 0;
+         }
+
+         // Node which the calling thread is running on. Threads may migrate, so this is a hint.
+         std::size_t current_node() const {
+            const int cpu = sched_getcpu();
+            return (cpu < 0) ? 0 : node_of(static_cast<unsigned>(cpu));
+         }
+
+         // Pin the calling thread to the CPUs of a node
+         void bind_current_thread(const std::size_t node) const {
+            const auto & cpus = cpus_of(node);
+            if(cpus.empty()) throw std::invalid_argument{"Cannot bind a thread to a NUMA node without CPUs"};
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            for(const unsigned cpu : cpus) CPU_SET(cpu, &cpu_set);
+            if(sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+               throw std::system_error(errno, std::generic_category(), "sched_setaffinity");
+            }
+         }
+
+      private:
+         std::vector<std::vector<unsigned>> m_node_cpus;
+         std::vector<std::size_t> m_cpu_nodes;
+
+         explicit topology(std::vector<std::vector<unsigned>> node_cpus) :
+            m_node_cpus{std::move(node_cpus)},
+            m_cpu_nodes{}
+         {
+            for(std::size_t node = 0; node < m_node_cpus.size(); ++node) {
+               for(const unsigned cpu : m_node_cpus[node]) {
+                  if(cpu >= m_cpu_nodes.size()) m_cpu_nodes.resize(cpu + 1, 0);
+                  m_cpu_nodes[cpu] = node;
+               }
+            }
+         }
+
+         static std::shared_ptr<const topology> detect() {
+            const std::string root = "/sys/devices/system/node/";
+            std::vector<std::vector<unsigned>> node_cpus;
+            std::string line;
+            if(detail::read_line(root + "online", line)) {
+               for(const unsigned node : detail::parse_list(line)) {
+                  std::string cpu_list;
+                  detail::read_line(root + "node" + std::to_string(node) + "/cpulist", cpu_list);
+                  node_cpus.push_back(detail::parse_list(cpu_list));
+               }
+            }
+            if(node_cpus.empty()) node_cpus.push_back(detail::allowed_cpus());
+            return std::shared_ptr<const topology>{new topology{std::move(node_cpus)}};
+         }
+   };
+
+}
+
+// This variant of copy_on_write_ptr is meant for read-mostly payloads which are shared by threads
+// running on several NUMA nodes. Besides the payload itself, which lives on the node where it was
+// created, it lazily makes one read-only replica per other node, so that read() is served from
+// local memory. Replicas are shared by all the pointers which share the payload.
+//
+// Replicas are copied by the first thread which reads on a node, so that the memory allocator
+// and the kernel's first-touch policy put them on that node. This is a best effort: an allocator
+// may hand out memory which was first touched elsewhere, and threads may migrate.
+//
+// Writes acquire ownership as usual. A lazy copy starts from a fresh payload without replicas,
+// whereas an owner discards the replicas of its private payload before writing to it. As with
+// copy_on_write_ptr, a pointer must thus not be written to while other threads read through it.
+template <typename T,
+          typename OwnershipFlag>
+class replicated_copy_on_write_ptr {
+   static_assert(cow_ownership_flags::check_ownership_flag<OwnershipFlag, true>::value,
+                 "Invalid ownership flag");
+
+   public:
+      // === BASIC CLASS LIFECYCLE ===
+
+      // Construct from a raw pointer, acquire ownership. Replicas are made for the nodes of the
+      // topology, which defaults to that of the machine.
+      replicated_copy_on_write_ptr(T * ptr,
+                                   std::shared_ptr<const cow_numa::topology> topology = cow_numa::topology::system()) :
+         m_replicas{std::make_shared<Replicas>(std::unique_ptr<T>{ptr}, std::move(topology))},
+         m_ownership{true}
+      { }
+
+      // Move-construct from a replicated_copy_on_write_ptr, take over its ownership status.
+      replicated_copy_on_write_ptr(replicated_copy_on_write_ptr && cptr) :
+         m_replicas{std::move(cptr.m_replicas)},
+         m_ownership{std::move(cptr.m_ownership)}
+      { }
+
+      // Copy-construct from a replicated_copy_on_write_ptr, DO NOT acquire ownership, and make
+      // the source give up ownership too as its payload and replicas are now shared.
+      replicated_copy_on_write_ptr(const replicated_copy_on_write_ptr & cptr) :
+         m_replicas{cptr.m_replicas},
+         m_ownership{false}
+      {
+         cptr.m_ownership.set_ownership(false);
+      }
+
+      // All our data members can take care of themselves on their own.
+      ~replicated_copy_on_write_ptr() = default;
+
+      // Moving a replicated_copy_on_write_ptr transfers ownership of the underlying data
+      replicated_copy_on_write_ptr & operator=(replicated_copy_on_write_ptr && cptr) = default;
+
+      // Copying a replicated_copy_on_write_ptr DOES NOT transfer ownership of the underlying content
+      replicated_copy_on_write_ptr & operator=(const replicated_copy_on_write_ptr & cptr) {
+         cptr.m_ownership.set_ownership(false);
+         m_ownership.set_ownership(false);
+         m_replicas = cptr.m_replicas;
+         return *this;
+      }
+
+
+      // === DATA ACCESS ===
+
+      // Read from the replica of the node which we are running on, making it if needed.
+      // CAUTION: Be careful with references to non-const CoW data, as writes may invalidate them.
+      const T & read() const { return m_replicas->read_on(m_replicas->topology->current_node()); }
+
+      // Read from the replica of a specific node, e.g. to serve a thread which runs elsewhere
+      const T & read_on(const std::size_t node) const {
+         if(node >= m_replicas->topology->node_count()) throw std::out_of_range{"No such NUMA node"};
+         return m_replicas->read_on(node);
+      }
+
+      // Writing to copy-on-write data requires ownership, which must be acquired as needed.
+      void write(const T & value) {
+         modify([&](T & payload){ payload = value; });
+      }
+
+      void write(T && value) {
+         modify([&](T & payload){ payload = std::move(value); });
+      }
+
+      // Modify the payload in place once ownership has been acquired and replicas are discarded.
+      // CAUTION: The reference must not be kept around after the callable returns.
+      template <typename Callable>
+      void modify(Callable && modifier) {
+         m_ownership.acquire_ownership_once([this](){ make_private_copy(); });
+         m_replicas->discard_replicas();
+         modifier(*m_replicas->payload);
+      }
+
+
+      // === REPLICA MANAGEMENT ===
+
+      // Amount of replicas which currently exist, the original payload excluded
+      std::size_t replica_count() const { return m_replicas->replica_count(); }
+
+      const cow_numa::topology & topology() const { return *m_replicas->topology; }
+
+   private:
+
+      // A payload, along with its replicas on other nodes
+      struct Replicas {
+         std::unique_ptr<T> payload;
+         std::shared_ptr<const cow_numa::topology> topology;
+         std::size_t home_node;  // Node where the payload was made, which needs no replica
+         std::unique_ptr<std::atomic<const T *>[]> replicas;
+
+         Replicas(std::unique_ptr<T> && initial_payload,
+                  std::shared_ptr<const cow_numa::topology> && payload_topology) :
+            payload{std::move(initial_payload)},
+            topology{std::move(payload_topology)},
+            home_node{topology->current_node()},
+            replicas{new std::atomic<const T *>[topology->node_count()]()}
+         { }
+
+         ~Replicas() { discard_replicas(); }
+
+         // Replica for a node, made by the calling thread if it does not exist yet. If several
+         // threads race to make it, the first one wins and the others throw away their copy.
+         const T & read_on(const std::size_t node) {
+            if(node == home_node) return *payload;
+            std::atomic<const T *> & slot = replicas[node];
+            const T * replica = slot.load(std::memory_order_acquire);
+            if(replica != nullptr) return *replica;
+            std::unique_ptr<const T> copy{new T(*payload)};
+            if(slot.compare_exchange_strong(replica, copy.get(), std::memory_order_acq_rel, std::memory_order_acquire)) {
+               return *copy.release();
+            }
+            return *replica;
+         }
+
+         // Nearest existing copy of the payload, which lazy copies are best made from
+         const T & nearest(const std::size_t node) const {
+            const T * const replica = (node == home_node) ? nullptr : replicas[node].load(std::memory_order_acquire);
+            return (replica != nullptr) ? *replica : *payload;
+         }
+
+         // Only meant to be called by the owner, as no other pointer may be reading then. Warm
+         // writes call this every time, usually with no replica around, so only plain loads and
+         // stores are used: read-modify-write operations are locked instructions on x86.
+         void discard_replicas() {
+            for(std::size_t node = 0; node < topology->node_count(); ++node) {
+               std::atomic<const T *> & slot = replicas[node];
+               const T * const replica = slot.load(std::memory_order_relaxed);
+               if(replica == nullptr) continue;
+               slot.store(nullptr, std::memory_order_relaxed);
+               delete replica;
+            }
+         }
+
+         std::size_t replica_count() const {
+            std::size_t count = 0;
+            for(std::size_t node = 0; node < topology->node_count(); ++node) {
+               count += (replicas[node].load(std::memory_order_relaxed) != nullptr);
+            }
+            return count;
+         }
+      };
+
+      std::shared_ptr<Replicas> m_replicas;
+      mutable OwnershipFlag m_ownership;  // Copying a const pointer revokes its ownership
+
+      // Make a private payload on our node, starting from the nearest copy of the shared one
+      void make_private_copy() {
+         const auto & topology = m_replicas->topology;
+         std::unique_ptr<T> payload{new T(m_replicas->nearest(topology->current_node()))};
+         m_replicas = std::make_shared<Replicas>(std::move(payload), std::shared_ptr<const cow_numa::topology>{topology});
+      }
+};
+
+#endif
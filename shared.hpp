@@ -17,6 +17,21 @@
 #define SHARED_H
 
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+
+#ifdef __linux__
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 // These shared facilities are used by all my copy-on-write benchmarking programs
 namespace Shared {
@@ -39,6 +54,200 @@ namespace Shared {
       return end_time - start_time;
    }
    
+   // Hardware events which are counted during each benchmark, to tell where the time goes
+   enum class Event { Cycles, Instructions, L1DMisses, LLCMisses, BranchMisses, LockedLoads };
+   const std::size_t EventAmount = 6;
+
+   // Measurement of Linux perf_event_open counters. The counters themselves are opened once per
+   // process, the first time that measurements are made or open_process_counters() is called, and
+   // are then reused by every measurement. With pid = 0 and inherit set, they only cover the calling
+   // thread and the threads which it spawns afterwards, so benchmarks open them before spawning any
+   // thread (e.g. thread pools or background reclaimers). Counters which the hardware, kernel or
+   // permissions (see /proc/sys/kernel/perf_event_paranoid) do not allow are reported as unavailable.
+   class PerfCounters {
+      public:
+         PerfCounters() {
+            open_process_counters();
+            for(std::size_t i = 0; i < EventAmount; ++i) m_counts[i] = -1.0;
+         }
+
+         static void open_process_counters() { ProcessCounters::instance(); }
+
+         bool any_available() const {
+            const ProcessCounters & counters = ProcessCounters::instance();
+            for(std::size_t i = 0; i < EventAmount; ++i) {
+               if(counters.fds[i] >= 0) return true;
+            }
+            return false;
+         }
+
+         // Counters are not reset between measurements, as resetting them would not clear the
+         // counts which threads that exited since they were opened handed over to their parent.
+         // Instead, each measurement reads them at start and stop, and takes the difference.
+         void start() {
+#ifdef __linux__
+            const ProcessCounters & counters = ProcessCounters::instance();
+            for(std::size_t i = 0; i < EventAmount; ++i) {
+               if(counters.fds[i] < 0) continue;
+               read_counter(counters.fds[i], m_start_values[i]);
+               ioctl(counters.fds[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+         }
+
+         // Stop counting and read the counters. If the kernel had to multiplex them because there
+         // were not enough hardware counters, counts are extrapolated to the full measurement time.
+         void stop() {
+#ifdef __linux__
+            const ProcessCounters & counters = ProcessCounters::instance();
+            for(std::size_t i = 0; i < EventAmount; ++i) {
+               if(counters.fds[i] < 0) continue;
+               ioctl(counters.fds[i], PERF_EVENT_IOC_DISABLE, 0);
+               std::uint64_t value[3];
+               if(!read_counter(counters.fds[i], value)) {
+                  m_counts[i] = -1.0;
+                  continue;
+               }
+               const std::uint64_t count = value[0] - m_start_values[i][0];
+               const std::uint64_t enabled = value[1] - m_start_values[i][1];
+               const std::uint64_t running = value[2] - m_start_values[i][2];
+               m_counts[i] = (running > 0) ? count * (static_cast<double>(enabled) / running) : -1.0;
+            }
+#endif
+         }
+
+         // Count of an event during the last measurement, or a negative value if it's unavailable
+         double count(const Event event) const {
+            return m_counts[static_cast<std::size_t>(event)];
+         }
+
+         static const char * name(const Event event) {
+            static const char * const names[EventAmount] = {
+               "cycles", "instructions", "L1D misses", "LLC misses", "branch misses", "locked loads"
+            };
+            return names[static_cast<std::size_t>(event)];
+         }
+
+      private:
+         double m_counts[EventAmount];
+         std::uint64_t m_start_values[EventAmount][3] = {};
+
+         // Counters of the whole process, which are deliberately leaked as threads may still be
+         // running when static destructors are called
+         struct ProcessCounters {
+            int fds[EventAmount];
+
+            ProcessCounters() {
+               for(std::size_t i = 0; i < EventAmount; ++i) fds[i] = open_counter(static_cast<Event>(i));
+            }
+
+            static const ProcessCounters & instance() {
+               static const ProcessCounters * const counters = new ProcessCounters{};
+               return *counters;
+            }
+         };
+
+#ifdef __linux__
+         // Read a counter's value, along with the times during which it was enabled and running
+         static bool read_counter(const int fd, std::uint64_t (& value)[3]) {
+            return read(fd, value, sizeof(value)) == sizeof(value);
+         }
+#endif
+
+         // Locked instructions have no generic perf event. On Intel CPUs from Sandy Bridge onwards,
+         // retired locked loads (event 0xD0, umask 0x21) are a good proxy for them.
+         static bool is_intel_cpu() {
+            std::ifstream cpuinfo("/proc/cpuinfo");
+            std::string line;
+            while(std::getline(cpuinfo, line)) {
+               if(line.compare(0, 9, "vendor_id") == 0) return line.find("GenuineIntel") != std::string::npos;
+            }
+            return false;
+         }
+
+         static int open_counter(const Event event) {
+#ifdef __linux__
+            perf_event_attr attributes;
+            std::memset(&attributes, 0, sizeof(attributes));
+            attributes.size = sizeof(attributes);
+            attributes.disabled = 1;
+            attributes.inherit = 1;
+            attributes.exclude_kernel = 1;
+            attributes.exclude_hv = 1;
+            attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            attributes.type = PERF_TYPE_HARDWARE;
+            switch(event) {
+               case Event::Cycles:
+                  attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+                  break;
+               case Event::Instructions:
+                  attributes.config = PERF_COUNT_HW_INSTRUCTIONS;
+                  break;
+               case Event::L1DMisses:
+                  attributes.type = PERF_TYPE_HW_CACHE;
+                  attributes.config = PERF_COUNT_HW_CACHE_L1D |
+                                      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                  break;
+               case Event::LLCMisses:
+                  attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+                  break;
+               case Event::BranchMisses:
+                  attributes.config = PERF_COUNT_HW_BRANCH_MISSES;
+                  break;
+               case Event::LockedLoads:
+                  if(!is_intel_cpu()) return -1;
+                  attributes.type = PERF_TYPE_RAW;
+                  attributes.config = 0x21d0;
+                  break;
+            }
+            return static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+#else
+            (void) event;
+            return -1;
+#endif
+         }
+   };
+
+   // Variant of time_it which also records hardware performance counters
+   template <typename Callable,
+             typename DurationType = Duration>
+   DurationType measure_it(Callable && operation,
+                           const std::size_t amount,
+                           PerfCounters & counters) {
+      counters.start();
+      const DurationType duration = time_it<Callable, DurationType>(std::forward<Callable>(operation), amount);
+      counters.stop();
+      return duration;
+   }
+
+   // Print the counters of a measurement, normalized per operation. If no counter is available,
+   // say so once and then stay quiet, so that benchmark output remains readable.
+   inline void print_counters(const PerfCounters & counters, const std::size_t amount) {
+      if(!counters.any_available()) {
+         static bool warned = false;
+         if(!warned) {
+            std::cout << "(Hardware performance counters are unavailable, only timings will be reported)" << std::endl;
+            warned = true;
+         }
+         return;
+      }
+      std::cout << "   Per operation:";
+      for(std::size_t i = 0; i < EventAmount; ++i) {
+         const Event event = static_cast<Event>(i);
+         const double count = counters.count(event);
+         std::cout << ((i == 0) ? " " : ", ");
+         if(count < 0) {
+            std::cout << "n/a ";
+         } else {
+            std::cout << count / amount << ' ';
+         }
+         std::cout << PerfCounters::name(event);
+      }
+      std::cout << std::endl;
+   }
+   
    // Define the data type used by the test, and a typical value of it
    using Data = int;
    const Data typical_value = 42;